@@ -18,6 +18,8 @@
 #include <algorithm>
 #include <string>
 #include <iterator>
+#include <cstring>
+#include <cstdlib>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -27,6 +29,13 @@
 
 #include <math.h>
 #include "texture.h"
+#include "playback.h"
+#include "stream.h"
+#include "warp.h"
+#include "catalog.h"
+#include "latency.h"
+#include "sat.h"
+#include "cache.h"
 
 #define PI 3.14159265359
 using namespace std;
@@ -37,27 +46,41 @@ using namespace glm;
 void QueryGLVersion();
 bool CheckGLErrors();
 
-float ratio = 0.0f;			//ratio of 1 GL unit to n pixel 
-
 string LoadSource(const string &filename);
 GLuint CompileShader(GLenum shaderType, const string &source);
 GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
-char filePaths[6][50] ={
-	"./images/image1-mandrill.png",
-	"./images/image2-uclogo.png",
-	"./images/image3-aerial.jpg",
-	"./images/image4-thirsk.jpg",
-	"./images/image5-pattern.png",
-	"./images/bard.jpg"
-	
-} ;
+
+// images browsed with LEFT/RIGHT, indexed from this directory tree
+char imageDirectory[256] = "./images";
+Catalog catalog;
 
 int windowWidth, windowHeight;
 int picNumber = -1,  theta = 0, filterMode = 0;
+bool compareRequested = false;
 float offsetX = .0f, offsetY = .0f, resize = 1.f; 
 MyTexture myTex;
 GLuint program;
 
+// image-sequence playback, toggled with P
+char sequencePattern[256] = "./frames/frame%04d.png";
+float sequenceFps = 30.f;
+Playback *playback = 0;
+
+// input-to-present latency, low-latency mode toggled with L
+FrameLatency frameLatency;
+double pendingInputTime = -1.0;		// when the newest undrawn drag arrived
+
+// neighbourhood filters (modes 4-6) from a summed-area table; imageVersion
+// changes whenever the displayed image does, so the table is rebuilt then
+SummedAreaTable sat;
+int satRadius = 8;
+int imageVersion = 0;
+
+// filtered catalog images, rendered once per (image, filter) and then only
+// resampled; the budget is set with --cache-mb
+ResultCache resultCache;
+int cacheMegabytes = 256;
+
 // --------------------------------------------------------------------------
 // Functions to set up OpenGL shader programs for rendering
 
@@ -221,72 +244,6 @@ void drawFullPic(GLuint program, float factor, MyTexture mtex, float theta, floa
 
 	float width = mtex.width;
 	float height = mtex.height;
-	float x = 0.0f, y = 0.0f; 			
-	
-	float windowRatio = 0.0f;
-
-	vec2 rotation[] = {
-		vec2(cos(theta*PI/180), -1*sin(theta*PI/180)),
-		vec2(sin(theta*PI/180), cos(theta*PI/180))
-	};
-
-/*
-	//unlimited rotation works
-	glm::mat4 rotation = glm::mat4 (1.0f);
-	rotation = glm::rotate(rotation, glm::radians(theta), glm::vec3(0.f,0.f,1.f));
-
-	glUseProgram(program);
-	GLint rot = glGetUniformLocation(program, "rotationMatrix");
-	glUniformMatrix4fv(rot, 1, GL_FALSE, glm::value_ptr(rotation));
-	glUseProgram(0);
-*/
-
-	if (height > width){
-
-		ratio = 1/(height/2);
-		x = (width/2)*ratio;
-		y = 1.0f;
-	}
-	else if (height < width){
-		ratio = 1/(width/2);
-		y = (height/2)*ratio;
-		x = 1.0f;
-	}
-	else{
-		y = 1.0f;
-		x = 1.0f;
-
-	}
-
-	//Scale with window
-	if (windowWidth > windowHeight){
-		windowRatio = windowWidth/windowHeight;
-		
-		//scalingMatrix = glm::scale(windowRatio, 1.0f ,1.0f);
-		
-	}	
-	else  if (windowHeight > windowWidth){
-		windowRatio = windowHeight/windowWidth;
-		
-		//scalingMatrix = glm::scale(1.0f, windowRatio ,1.0f);
-	}
-
-
-	
-
-	
-
-
-	// three vertex positions and assocated colours of a triangle
-	vec2 vertices[] = {
-		vec2( (-1.0f*x)/factor, y/factor ),
-		vec2( (-1.0f*x)/factor,  (-1.0f*y)/factor ),
-		vec2( x/factor, (-1.0f*y)/factor ),
-
-		vec2( (-1.0f*x)/factor, y/factor ),
-		vec2( x/factor,  y/factor ),
-		vec2( x/factor, (-1.0f*y)/factor )
-	};
 
 	//	need vec2 texture
 	vec2 texCord[] = {
@@ -299,34 +256,14 @@ void drawFullPic(GLuint program, float factor, MyTexture mtex, float theta, floa
 		vec2( width, 0.0f )
 	};
 
+	// rotation, scale, window aspect and translation all live in one affine
+	// map, shared with the CPU renderer so both produce the same view
+	ViewTransform view = ComputeViewTransform(width, height, factor, theta,
+		offsetX, offsetY, windowWidth, windowHeight);
 
-
-
-	//transformation
-	for (int i = 0; i < 6; i++){
-		
-		
-		//rotation
-		float newX = (vertices[i][0] * rotation[0][0]) + (vertices[i][1] * rotation[0][1]);
-		float newY = (vertices[i][0] * rotation[1][0]) + (vertices[i][1] * rotation[1][1]);
-		vertices[i] = vec2(newX, newY);
-		
-
-		
-		//scale with window
-		if (windowHeight > windowWidth)
-			vertices[i].y /= windowRatio;
-		if (windowHeight < windowWidth)
-			vertices[i].x /= windowRatio;
-		
-
-		//translation
-		newX = vertices[i][0] + offsetX;
-		newY = vertices[i][1] + offsetY;
-		vertices[i] = vec2(newX, newY);
-	}
-
-
+	vec2 vertices[6];
+	for (int i = 0; i < 6; i++)
+		view.Apply(texCord[i].x, texCord[i].y, &vertices[i].x, &vertices[i].y);
 
 	// call function to create and fill buffers with geometry data
 	Geometry geometry;
@@ -371,6 +308,45 @@ void drawFullPic(GLuint program, float factor, MyTexture mtex, float theta, floa
 
 
 }
+// renders the current view with the CPU warp and compares it against what
+// GL just drew into the back buffer
+void CompareCpuRender(const char *filename){
+
+	CpuImage source, cpu, gpu;
+	if (!LoadCpuImage(&source, filename))
+		return;
+
+	cpu.width = gpu.width = windowWidth;
+	cpu.height = gpu.height = windowHeight;
+	gpu.pixels.resize(size_t(windowWidth) * windowHeight * 4);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadBuffer(GL_BACK);
+	glReadPixels(0, 0, windowWidth, windowHeight, GL_RGBA, GL_UNSIGNED_BYTE, &gpu.pixels[0]);
+	CheckGLErrors();
+
+	ViewTransform view = ComputeViewTransform(float(source.width), float(source.height),
+		resize, float(theta), offsetX, offsetY, windowWidth, windowHeight);
+
+	double start = glfwGetTime();
+	RenderViewCpu(source, view, filterMode, &cpu);
+	double elapsed = glfwGetTime() - start;
+
+	// differences along the quad's edges come from GL's rasterization rules
+	int maxDiff = 0, differing = 0;
+	for (size_t i = 0; i < cpu.pixels.size(); i += 4){
+		int diff = 0;
+		for (int c = 0; c < 3; c++)
+			diff = std::max(diff, abs(int(cpu.pixels[i + c]) - int(gpu.pixels[i + c])));
+		maxDiff = std::max(maxDiff, diff);
+		if (diff > 1) differing++;
+	}
+
+	cout << "CPU render " << windowWidth << "x" << windowHeight << " in "
+		<< elapsed*1000.0 << " ms; " << differing << " pixels differ from GL by more than 1"
+		<< " (max difference " << maxDiff << ")" << endl;
+}
+
 // --------------------------------------------------------------------------
 // GLFW callback functions
 
@@ -389,17 +365,18 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
 
-	if (key == GLFW_KEY_LEFT && action == GLFW_PRESS){
+	if (key == GLFW_KEY_LEFT && action == GLFW_PRESS && !catalog.entries.empty()){
 		resize = 1; theta = 0; offsetX = 0.0f; offsetY = 0.0f, filterMode = 0; 
 	
 		if (picNumber <= 0)
-			picNumber = 6;
+			picNumber = int(catalog.entries.size());
 
 		
 
 		//MyTexture myTex;
 
-		if (InitializeTexture(&myTex, filePaths[--picNumber], GL_TEXTURE_RECTANGLE)){
+		imageVersion++;
+		if (InitializeTexture(&myTex, CatalogFile(&catalog, --picNumber).c_str(), GL_TEXTURE_RECTANGLE)){
 			cout << "hi" << endl;
 		}
 		
@@ -418,18 +395,19 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 	
 		
 	}
-	if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS){
+	if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS && !catalog.entries.empty()){
 		resize = 1; theta = 0; offsetX = 0.0f; offsetY = 0.0f, filterMode = 0; 
 	
 
-		if(picNumber == 5)
+		if(picNumber >= int(catalog.entries.size()) - 1)
 			picNumber = -1;
 		
 		picNumber;
 
 		//MyTexture myTex;
 
-		if (InitializeTexture(&myTex, filePaths[++picNumber], GL_TEXTURE_RECTANGLE)){
+		imageVersion++;
+		if (InitializeTexture(&myTex, CatalogFile(&catalog, ++picNumber).c_str(), GL_TEXTURE_RECTANGLE)){
 			cout << "hi" << endl;
 		}
 
@@ -465,6 +443,25 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		filterMode = 3;
 	//	drawFullPic(program,resize, myTex, theta , offsetX, offsetY);
 	}
+	if ((key == GLFW_KEY_4 || key == GLFW_KEY_5 || key == GLFW_KEY_6) && action == GLFW_PRESS){
+		// fragment.glsl has no branch for these modes, so they need the table
+		if (sat.filterProgram == 0)
+			cout << "Summed-area table filters are unavailable, see the errors at startup" << endl;
+		else if (key == GLFW_KEY_4)
+			filterMode = SAT_MODE_BOX_BLUR;
+		else if (key == GLFW_KEY_5)
+			filterMode = SAT_MODE_VARIANCE;
+		else
+			filterMode = SAT_MODE_THRESHOLD;
+	}
+	if (key == GLFW_KEY_LEFT_BRACKET && (action == GLFW_PRESS || action == GLFW_REPEAT)){
+		satRadius = std::max(1, satRadius - std::max(1, satRadius/4));
+		cout << "Filter radius " << satRadius << endl;
+	}
+	if (key == GLFW_KEY_RIGHT_BRACKET && (action == GLFW_PRESS || action == GLFW_REPEAT)){
+		satRadius += std::max(1, satRadius/4);
+		cout << "Filter radius " << satRadius << endl;
+	}
 	if(key == GLFW_KEY_KP_ADD && (action == GLFW_PRESS || action == GLFW_REPEAT)){
 
 		theta+=5;
@@ -478,6 +475,31 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 		//cout << theta << endl;
 		//drawFullPic(program,resize, myTex, theta , offsetX, offsetY);
 	}
+	if (key == GLFW_KEY_V && action == GLFW_PRESS){
+		compareRequested = true;
+	}
+	if (key == GLFW_KEY_L && action == GLFW_PRESS){
+		SetLowLatency(&frameLatency, !frameLatency.lowLatency);
+		cout << (frameLatency.lowLatency ? "Low-latency mode on" : "Low-latency mode off") << endl;
+		ReportLatency(&frameLatency);
+	}
+	if (key == GLFW_KEY_P && action == GLFW_PRESS){
+
+		if (playback){
+			ReportPlayback(playback);
+			DestroyPlayback(playback);
+			delete playback;
+			playback = 0;
+		}
+		else{
+			playback = new Playback;
+			if (!InitializePlayback(playback, sequencePattern, sequenceFps)){
+				DestroyPlayback(playback);
+				delete playback;
+				playback = 0;
+			}
+		}
+	}
 
 
 }
@@ -497,7 +519,9 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 	//drawFullPic(program,resize, myTex, theta , offsetX, offsetY);
 }
 
-static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
+// pans the image by the cursor movement while the left button is held;
+// returns true if the offsets changed
+bool DragImage(GLFWwindow* window, double xpos, double ypos)
 {
 	static vec2 LastPostion(0, 0);
 	/*
@@ -510,12 +534,11 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
 	*/
 	vec2 CurrentPosition((xpos-(windowWidth/2))/(windowWidth/2), 
 							(ypos-(windowHeight/2))/(windowHeight/2)*-1.f);
-	
-	GLuint program = InitializeShaders();
-	
+	bool moved = false;
 
 	int state = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT);
 	if (state == GLFW_PRESS){
+		moved = CurrentPosition.x != LastPostion.x || CurrentPosition.y != LastPostion.y;
 		offsetX += CurrentPosition.x - LastPostion.x;
 		offsetY += CurrentPosition.y - LastPostion.y;
 		
@@ -526,6 +549,17 @@ static void cursor_position_callback(GLFWwindow* window, double xpos, double ypo
 	}
     
 	LastPostion= CurrentPosition;
+	return moved;
+}
+
+static void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
+{
+	// in low-latency mode the render loop latches the cursor itself
+	if (frameLatency.lowLatency)
+		return;
+
+	if (DragImage(window, xpos, ypos))
+		pendingInputTime = glfwGetTime();
 }
 
 void window_size_callback(GLFWwindow* window, int width, int height)
@@ -541,6 +575,53 @@ void window_size_callback(GLFWwindow* window, int width, int height)
 
 int main(int argc, char *argv[])
 {
+	// headless band-by-band filtering: --stream input output [mode] [bandHeight]
+	if (argc > 3 && strcmp(argv[1], "--stream") == 0){
+		int mode = argc > 4 ? atoi(argv[4]) : 0;
+		int bandHeight = argc > 5 ? atoi(argv[5]) : 256;
+
+		StreamStats stats;
+		if (!StreamFilterImage(argv[2], argv[3], mode, bandHeight, &stats))
+			return -1;
+
+		cout << "Filtered " << stats.width << "x" << stats.height << " in "
+			<< stats.bands << " bands, " << stats.seconds << " s ("
+			<< (double(stats.width) * stats.height / 1e6) / stats.seconds << " Mpixel/s), "
+			<< "peak memory " << stats.peakMemoryKB / 1024 << " MB" << endl;
+		return 0;
+	}
+
+	// headless thumbnail: --thumbnail input output [size] [mode]
+	if (argc > 3 && strcmp(argv[1], "--thumbnail") == 0){
+		int size = argc > 4 ? atoi(argv[4]) : 256;
+		int mode = argc > 5 ? atoi(argv[5]) : 0;
+		return RenderThumbnail(argv[2], argv[3], size, mode) ? 0 : -1;
+	}
+
+	// viewer options: --images directory, --sequence pattern, --fps rate,
+	// --swap-interval n (used in low-latency mode), --cache-mb budget
+	for (int i = 1; i + 1 < argc; i += 2){
+		if (strcmp(argv[i], "--images") == 0){
+			strncpy(imageDirectory, argv[i + 1], sizeof(imageDirectory) - 1);
+			imageDirectory[sizeof(imageDirectory) - 1] = '\0';
+		}
+		else if (strcmp(argv[i], "--sequence") == 0){
+			strncpy(sequencePattern, argv[i + 1], sizeof(sequencePattern) - 1);
+			sequencePattern[sizeof(sequencePattern) - 1] = '\0';
+		}
+		else if (strcmp(argv[i], "--fps") == 0)
+			sequenceFps = float(atof(argv[i + 1]));
+		else if (strcmp(argv[i], "--swap-interval") == 0)
+			frameLatency.lowSwapInterval = atoi(argv[i + 1]);
+		else if (strcmp(argv[i], "--cache-mb") == 0)
+			cacheMegabytes = std::max(0, atoi(argv[i + 1]));
+		else
+			cout << "Ignoring unknown option " << argv[i] << endl;
+	}
+
+	// index the image directory before the window opens
+	OpenCatalog(&catalog, imageDirectory);
+
 	// initialize the GLFW windowing system
 	if (!glfwInit()) {
 		cout << "ERROR: GLFW failed to initialize, TERMINATING" << endl;
@@ -583,12 +664,19 @@ int main(int argc, char *argv[])
 	// query and print out information about our OpenGL environment
 	QueryGLVersion();
 
+	// start in normal mode: vsync on, frames queued as the driver likes
+	SetLowLatency(&frameLatency, false);
+
 	// call function to load and compile shader programs
 	GLuint program = InitializeShaders();
 	if (program == 0) {
 		cout << "Program could not initialize shaders, TERMINATING" << endl;
 		return -1;
 	}
+	if (!InitializeSummedAreaTable(&sat))
+		cout << "Summed-area table filters are unavailable" << endl;
+	if (!InitializeResultCache(&resultCache, size_t(cacheMegabytes) * 1024 * 1024))
+		cout << "Filter results will not be cached" << endl;
 /*
 	// three vertex positions and assocated colours of a triangle
 	vec2 vertices[] = {
@@ -651,7 +739,10 @@ int main(int argc, char *argv[])
 	
 
 
-		if (InitializeTexture(&myTex, filePaths[picNumber], GL_TEXTURE_RECTANGLE)){
+		if (!catalog.entries.empty())
+			picNumber = 0;
+
+		if (picNumber >= 0 && InitializeTexture(&myTex, CatalogFile(&catalog, picNumber).c_str(), GL_TEXTURE_RECTANGLE)){
 			cout << "hi" << endl;
 		}
 		
@@ -676,12 +767,85 @@ int main(int argc, char *argv[])
 		
 		GLint fragMode = glGetUniformLocation(program, "mode");
 		glUniform1i(fragMode , filterMode);
-		drawFullPic(program,resize, myTex, theta , offsetX, offsetY);
+
+		// show the latest due sequence frame once one has been uploaded
+		MyTexture *shown = &myTex;
+		if (playback){
+			if (UpdatePlayback(playback))
+				imageVersion++;
+			if (playback->texture.width > 0)
+				shown = &playback->texture;
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_RECTANGLE, shown->textureID);
+
+		// late latching: in low-latency mode use the cursor position as it is
+		// right now rather than whatever the last event loop delivered
+		double inputTime = pendingInputTime;
+		pendingInputTime = -1.0;
+		if (frameLatency.lowLatency){
+			double xpos, ypos;
+			glfwGetCursorPos(window, &xpos, &ypos);
+			inputTime = DragImage(window, xpos, ypos) ? glfwGetTime() : -1.0;
+		}
+
+		// a filtered catalog image is looked up by content hash and filter
+		// settings; playback frames change too often to be worth keeping
+		bool filterReady = filterMode < SAT_MODE_BOX_BLUR || sat.filterProgram;
+		bool cacheable = filterMode != 0 && filterReady && shown == &myTex && picNumber >= 0;
+		uint64_t image = cacheable ? catalog.entries[picNumber].hash : 0;
+		int radius = filterMode >= SAT_MODE_BOX_BLUR ? satRadius : 0;
+		const MyTexture *cached = 0;
+		if (cacheable)
+			cached = FindCachedResult(&resultCache, image, filterMode, radius);
+
+		// neighbourhood filters draw from the table, rebuilt only when the
+		// image has changed since the last frame
+		GLuint drawProgram = program;
+		if (!cached){
+			if (filterMode >= SAT_MODE_BOX_BLUR && sat.filterProgram){
+				if (UpdateSummedAreaTable(&sat, *shown, imageVersion)){
+					BindSummedAreaTable(&sat, filterMode, satRadius);
+					drawProgram = sat.filterProgram;
+				}
+				else{
+					// no table for this image: show it unfiltered, not garbage
+					cout << "Summed-area table filters are unavailable for this image" << endl;
+					filterMode = 0;
+					cacheable = false;
+					glUseProgram(program);
+					glUniform1i(fragMode, 0);
+				}
+			}
+			if (cacheable)
+				cached = RenderCachedResult(&resultCache, *shown, image, filterMode, radius, drawProgram);
+		}
+
+		// the stored result is already filtered, so it is drawn unmodified
+		const MyTexture *drawn = shown;
+		if (cached){
+			drawn = cached;
+			drawProgram = program;
+			glUseProgram(program);
+			glUniform1i(fragMode, 0);
+			glBindTexture(GL_TEXTURE_RECTANGLE, cached->textureID);
+		}
+
+		drawFullPic(drawProgram,resize, *drawn, theta , offsetX, offsetY);
 
 		glUseProgram(0);
 
+		if (compareRequested){
+			compareRequested = false;
+			if (shown == &myTex && picNumber >= 0 && filterMode < SAT_MODE_BOX_BLUR)
+				CompareCpuRender(CatalogFile(&catalog, picNumber).c_str());
+		}
+
 		//timeElapsed += 0.01f;
 		glfwSwapBuffers(window);
+		FinishLatencyFrame(&frameLatency, inputTime);
+		if (playback)
+			NotePlaybackPresented(playback);
 
 		glfwPollEvents();
 		
@@ -689,6 +853,16 @@ int main(int argc, char *argv[])
 
 	// clean up allocated resources before exit
 	//DestroyGeometry(&geometry);
+	DestroyFrameLatency(&frameLatency);
+	ReportLatency(&frameLatency);
+	DestroySummedAreaTable(&sat);
+	ReportResultCache(&resultCache);
+	DestroyResultCache(&resultCache);
+	if (playback){
+		ReportPlayback(playback);
+		DestroyPlayback(playback);
+		delete playback;
+	}
 	glUseProgram(0);
 	glDeleteProgram(program);
 	glfwDestroyWindow(window);
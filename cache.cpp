@@ -0,0 +1,172 @@
+// ==========================================================================
+// Filter result cache
+// ==========================================================================
+
+#include "cache.h"
+
+#include <iostream>
+
+using namespace std;
+
+bool CheckGLErrors();
+
+// --------------------------------------------------------------------------
+// Storage management
+
+static void EvictEntry(ResultCache *cache, size_t index)
+{
+	glDeleteTextures(1, &cache->entries[index].texture.textureID);
+	cache->used -= cache->entries[index].bytes;
+	cache->entries.erase(cache->entries.begin() + index);
+	cache->evictions++;
+}
+
+// frees least-recently-used results until bytes more would fit
+static void MakeRoom(ResultCache *cache, size_t bytes)
+{
+	while (!cache->entries.empty() && cache->used + bytes > cache->budget)
+	{
+		size_t oldest = 0;
+		for (size_t i = 1; i < cache->entries.size(); i++)
+			if (cache->entries[i].lastUsed < cache->entries[oldest].lastUsed)
+				oldest = i;
+		EvictEntry(cache, oldest);
+	}
+}
+
+// --------------------------------------------------------------------------
+// Public interface
+
+bool InitializeResultCache(ResultCache *cache, size_t budgetBytes)
+{
+	cache->budget = budgetBytes;
+
+	glGenFramebuffers(1, &cache->framebuffer);
+
+	// quad covering the target, with texture coordinates in source texels;
+	// both buffers are filled per render since they depend on the image size
+	glGenBuffers(1, &cache->positionBuffer);
+	glGenBuffers(1, &cache->texcoordBuffer);
+	glGenVertexArrays(1, &cache->quadArray);
+	glBindVertexArray(cache->quadArray);
+
+	glBindBuffer(GL_ARRAY_BUFFER, cache->positionBuffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), 0);
+	glEnableVertexAttribArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, cache->texcoordBuffer);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), 0);
+	glEnableVertexAttribArray(1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	return !CheckGLErrors();
+}
+
+const MyTexture *FindCachedResult(ResultCache *cache, uint64_t image, int mode, int radius)
+{
+	for (size_t i = 0; i < cache->entries.size(); i++)
+	{
+		CachedResult &entry = cache->entries[i];
+		if (entry.image == image && entry.mode == mode && entry.radius == radius)
+		{
+			entry.lastUsed = ++cache->clock;
+			cache->hits++;
+			return &entry.texture;
+		}
+	}
+	return 0;
+}
+
+const MyTexture *RenderCachedResult(ResultCache *cache, const MyTexture &source,
+	uint64_t image, int mode, int radius, GLuint program)
+{
+	size_t bytes = size_t(source.width) * source.height * 4;
+	if (!cache->framebuffer || source.width <= 0 || source.height <= 0 || bytes > cache->budget)
+		return 0;
+
+	cache->misses++;
+	MakeRoom(cache, bytes);
+
+	CachedResult entry;
+	entry.image = image;
+	entry.mode = mode;
+	entry.radius = radius;
+	entry.bytes = bytes;
+	entry.lastUsed = ++cache->clock;
+
+	// sampled later exactly like a texture from InitializeTexture
+	entry.texture.target = GL_TEXTURE_RECTANGLE;
+	entry.texture.width = source.width;
+	entry.texture.height = source.height;
+	glGenTextures(1, &entry.texture.textureID);
+	glBindTexture(GL_TEXTURE_RECTANGLE, entry.texture.textureID);
+	glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, source.width, source.height, 0,
+		GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// the source goes back on unit 0 for the filter to read
+	glBindTexture(GL_TEXTURE_RECTANGLE, source.textureID);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, cache->framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE,
+		entry.texture.textureID, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		cout << "ERROR: Could not render filter result into the cache" << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteTextures(1, &entry.texture.textureID);
+		return 0;
+	}
+
+	// one fragment per source texel, sampled at the texel centre
+	float w = float(source.width), h = float(source.height);
+	const GLfloat positions[] = { -1.f, -1.f,  1.f, -1.f,  -1.f, 1.f,  1.f, 1.f };
+	const GLfloat texcoords[] = { 0.f, 0.f,  w, 0.f,  0.f, h,  w, h };
+	glBindBuffer(GL_ARRAY_BUFFER, cache->positionBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, cache->texcoordBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords), texcoords, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, source.width, source.height);
+
+	glUseProgram(program);
+	glBindVertexArray(cache->quadArray);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	CheckGLErrors();
+
+	cache->entries.push_back(entry);
+	cache->used += bytes;
+	return &cache->entries.back().texture;
+}
+
+void ReportResultCache(const ResultCache *cache)
+{
+	cout << "Result cache: " << cache->entries.size() << " results, "
+		<< cache->used / (1024*1024) << " of " << cache->budget / (1024*1024) << " MB, "
+		<< cache->hits << " hits, " << cache->misses << " misses, "
+		<< cache->evictions << " evictions" << endl;
+}
+
+void DestroyResultCache(ResultCache *cache)
+{
+	for (size_t i = 0; i < cache->entries.size(); i++)
+		glDeleteTextures(1, &cache->entries[i].texture.textureID);
+	glDeleteFramebuffers(1, &cache->framebuffer);
+	glDeleteBuffers(1, &cache->positionBuffer);
+	glDeleteBuffers(1, &cache->texcoordBuffer);
+	glDeleteVertexArrays(1, &cache->quadArray);
+	*cache = ResultCache();
+}
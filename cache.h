@@ -0,0 +1,61 @@
+// ==========================================================================
+// Filter result cache
+//
+// Renders each (image, filter configuration) once into a full-resolution
+// texture and keeps it, so later frames - and any pan, zoom or rotation -
+// only resample the stored result instead of re-running the filter. Results
+// are evicted least-recently-used first to stay within a memory budget.
+// ==========================================================================
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glad/glad.h>
+#include "texture.h"
+
+struct CachedResult
+{
+	// key: which image, and how it was filtered
+	uint64_t image;
+	int mode, radius;
+
+	MyTexture texture;		// RGBA8, same size as the source
+	size_t bytes;
+	uint64_t lastUsed;
+};
+
+struct ResultCache
+{
+	std::vector<CachedResult> entries;
+	size_t budget, used;		// bytes
+	uint64_t clock;				// bumped on every lookup, for LRU order
+
+	GLuint framebuffer;
+	GLuint quadArray, positionBuffer, texcoordBuffer;
+
+	int hits, misses, evictions;
+
+	ResultCache() : budget(0), used(0), clock(0), framebuffer(0), quadArray(0),
+		positionBuffer(0), texcoordBuffer(0), hits(0), misses(0), evictions(0)
+	{}
+};
+
+bool InitializeResultCache(ResultCache *cache, size_t budgetBytes);
+
+// returns the stored result for the key, or 0 if it has not been rendered
+const MyTexture *FindCachedResult(ResultCache *cache, uint64_t image, int mode, int radius);
+
+// renders source at full resolution through program (with its uniforms
+// already set and source bound to unit 0) and stores it under the key;
+// returns 0 if the result alone would exceed the budget
+const MyTexture *RenderCachedResult(ResultCache *cache, const MyTexture &source,
+	uint64_t image, int mode, int radius, GLuint program);
+
+void ReportResultCache(const ResultCache *cache);
+
+void DestroyResultCache(ResultCache *cache);
+
+#endif
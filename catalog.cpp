@@ -0,0 +1,381 @@
+// ==========================================================================
+// Image catalog
+//
+// Index file layout (native byte order):
+//   char[8]  magic "GICATIDX"
+//   uint32   version
+//   uint32   entry count
+//   per entry: uint64 size, int64 mtime, uint64 hash,
+//              int32 width, height, channels, format,
+//              uint16 path length, path bytes
+// ==========================================================================
+
+#include "catalog.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cctype>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <set>
+
+#include "stb_image.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+static const char indexName[] = ".catalog.idx";
+static const char indexMagic[8] = { 'G', 'I', 'C', 'A', 'T', 'I', 'D', 'X' };
+static const uint32_t indexVersion = 1;
+
+// --------------------------------------------------------------------------
+// Index file
+
+template <typename T>
+static bool ReadValue(istream &in, T *value)
+{
+	return bool(in.read((char *)value, sizeof(T)));
+}
+
+template <typename T>
+static void WriteValue(ostream &out, const T &value)
+{
+	out.write((const char *)&value, sizeof(T));
+}
+
+static bool LoadIndex(const string &filename, vector<CatalogEntry> *entries)
+{
+	ifstream in(filename.c_str(), ios::binary);
+	if (!in) return false;
+
+	char magic[8];
+	uint32_t version = 0, count = 0;
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, indexMagic, sizeof(magic)) != 0
+		|| !ReadValue(in, &version) || version != indexVersion || !ReadValue(in, &count))
+	{
+		cout << "Ignoring unreadable catalog index " << filename << endl;
+		return false;
+	}
+
+	// the count is not trusted until that many entries have actually been
+	// read, so a damaged index is rebuilt rather than sized from garbage
+	entries->clear();
+	for (uint32_t i = 0; i < count; i++)
+	{
+		CatalogEntry entry;
+		int32_t fields[4];
+		uint16_t length = 0;
+		if (!ReadValue(in, &entry.size) || !ReadValue(in, &entry.mtime)
+			|| !ReadValue(in, &entry.hash) || !ReadValue(in, &fields)
+			|| !ReadValue(in, &length))
+			break;
+
+		entry.width = fields[0];
+		entry.height = fields[1];
+		entry.channels = fields[2];
+		entry.format = fields[3];
+		entry.path.resize(length);
+		if (length && !in.read(&entry.path[0], length))
+			break;
+
+		entries->push_back(entry);
+	}
+	if (entries->size() == count) return true;
+
+	cout << "Ignoring truncated catalog index " << filename << endl;
+	entries->clear();
+	return false;
+}
+
+static bool SaveIndex(const string &filename, const vector<CatalogEntry> &entries)
+{
+	// write beside the old index and swap it in, so an interrupted save
+	// never leaves a half-written file behind
+	string temporary = filename + ".tmp";
+	{
+		ofstream out(temporary.c_str(), ios::binary | ios::trunc);
+		if (!out)
+		{
+			cout << "ERROR: Could not write catalog index " << filename << endl;
+			return false;
+		}
+
+		out.write(indexMagic, sizeof(indexMagic));
+		WriteValue(out, indexVersion);
+		WriteValue(out, uint32_t(entries.size()));
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			const CatalogEntry &entry = entries[i];
+			int32_t fields[4] = { entry.width, entry.height, entry.channels, entry.format };
+			WriteValue(out, entry.size);
+			WriteValue(out, entry.mtime);
+			WriteValue(out, entry.hash);
+			WriteValue(out, fields);
+			WriteValue(out, uint16_t(entry.path.size()));
+			out.write(entry.path.data(), entry.path.size());
+		}
+		if (!out) return false;
+	}
+
+	error_code error;
+	fs::rename(temporary, filename, error);
+	if (error)
+	{
+		cout << "ERROR: Could not replace catalog index " << filename << endl;
+		fs::remove(temporary, error);
+		return false;
+	}
+	return true;
+}
+
+// --------------------------------------------------------------------------
+// Parallel directory walk
+
+static bool IsImageName(const string &name)
+{
+	static const char *extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga" };
+
+	size_t dot = name.rfind('.');
+	if (dot == string::npos) return false;
+	string extension = name.substr(dot);
+	for (size_t i = 0; i < extension.size(); i++)
+		extension[i] = char(tolower((unsigned char)extension[i]));
+
+	for (size_t i = 0; i < sizeof(extensions)/sizeof(extensions[0]); i++)
+		if (extension == extensions[i]) return true;
+	return false;
+}
+
+struct CatalogWalk
+{
+	string root;
+	mutex lock;
+	condition_variable wake;
+	vector<string> pending;			// directories still to list, relative to root
+	set<string> visited;			// canonical paths of every directory queued
+	int busy;						// workers currently listing a directory
+	vector<CatalogEntry> found;		// images with size and mtime filled in
+
+	CatalogWalk() : busy(0)
+	{}
+};
+
+static void WalkWorker(CatalogWalk *walk)
+{
+	for (;;)
+	{
+		string directory;
+		{
+			unique_lock<mutex> guard(walk->lock);
+			walk->wake.wait(guard, [walk] { return !walk->pending.empty() || walk->busy == 0; });
+			if (walk->pending.empty()) return;		// nothing queued and nobody can queue more
+
+			directory = walk->pending.back();
+			walk->pending.pop_back();
+			walk->busy++;
+		}
+
+		vector<string> subdirectories;
+		vector<CatalogEntry> images;
+
+		error_code error;
+		fs::path full = directory.empty() ? fs::path(walk->root) : fs::path(walk->root) / directory;
+		for (fs::directory_iterator it(full, error), end; !error && it != end; it.increment(error))
+		{
+			string name = it->path().filename().string();
+			if (name.empty() || name[0] == '.') continue;		// hidden files and our index
+			string relative = directory.empty() ? name : directory + "/" + name;
+
+			// symlinked directories are followed, but each real directory is
+			// listed once, which also stops links back up the tree
+			error_code status;
+			if (it->is_directory(status))
+			{
+				fs::path canonical = fs::canonical(it->path(), status);
+				if (!status)
+				{
+					lock_guard<mutex> guard(walk->lock);
+					if (walk->visited.insert(canonical.string()).second)
+						subdirectories.push_back(relative);
+				}
+			}
+			else if (it->is_regular_file(status) && IsImageName(name))
+			{
+				CatalogEntry entry;
+				entry.path = relative;
+				entry.size = it->file_size(status);
+				entry.mtime = int64_t(it->last_write_time(status).time_since_epoch().count());
+				if (!status) images.push_back(entry);
+			}
+		}
+
+		{
+			lock_guard<mutex> guard(walk->lock);
+			walk->pending.insert(walk->pending.end(), subdirectories.begin(), subdirectories.end());
+			walk->found.insert(walk->found.end(), images.begin(), images.end());
+			walk->busy--;
+		}
+		walk->wake.notify_all();
+	}
+}
+
+// --------------------------------------------------------------------------
+// Probing new or changed files
+
+static int FormatFromSignature(const unsigned char *bytes, size_t length, const string &path)
+{
+	if (length >= 8 && memcmp(bytes, "\x89PNG\r\n\x1a\n", 8) == 0) return CATALOG_PNG;
+	if (length >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff) return CATALOG_JPEG;
+	if (length >= 2 && bytes[0] == 'B' && bytes[1] == 'M') return CATALOG_BMP;
+
+	// TGA has no signature; trust the extension
+	size_t dot = path.rfind('.');
+	if (dot != string::npos && (path.compare(dot, 4, ".tga") == 0 || path.compare(dot, 4, ".TGA") == 0))
+		return CATALOG_TGA;
+	return CATALOG_UNKNOWN;
+}
+
+// fills in format, dimensions and content hash; files that cannot be
+// decoded keep a zero width so later scans skip them without re-probing
+static void ProbeEntry(const string &root, CatalogEntry *entry)
+{
+	string filename = root + "/" + entry->path;
+	entry->width = entry->height = entry->channels = 0;
+
+	ifstream in(filename.c_str(), ios::binary);
+	if (!in) return;
+
+	// FNV-1a over the whole file
+	uint64_t hash = 14695981039346656037ull;
+	unsigned char buffer[1 << 16];
+	size_t first = 0;
+	while (in)
+	{
+		in.read((char *)buffer, sizeof(buffer));
+		size_t got = size_t(in.gcount());
+		if (first == 0)
+		{
+			first = got;
+			entry->format = FormatFromSignature(buffer, got, entry->path);
+		}
+		for (size_t i = 0; i < got; i++)
+			hash = (hash ^ buffer[i]) * 1099511628211ull;
+	}
+	entry->hash = hash;
+
+	if (entry->format == CATALOG_UNKNOWN
+		|| !stbi_info(filename.c_str(), &entry->width, &entry->height, &entry->channels))
+		entry->width = entry->height = entry->channels = 0;
+}
+
+// --------------------------------------------------------------------------
+// Public interface
+
+static bool ByPath(const CatalogEntry &a, const CatalogEntry &b)
+{
+	return a.path < b.path;
+}
+
+bool OpenCatalog(Catalog *catalog, const char *root, int threads)
+{
+	auto start = chrono::steady_clock::now();
+
+	catalog->root = root;
+	catalog->entries.clear();
+	catalog->probed = catalog->removed = 0;
+
+	error_code error;
+	if (!fs::is_directory(root, error))
+	{
+		cout << "ERROR: Image directory " << root << " does not exist" << endl;
+		return false;
+	}
+
+	// directory listing and probing are I/O bound, so oversubscribe the cores
+	if (threads <= 0)
+		threads = max(4, int(std::thread::hardware_concurrency()));
+
+	string indexFile = catalog->root + "/" + indexName;
+	vector<CatalogEntry> previous;
+	bool haveIndex = LoadIndex(indexFile, &previous);
+	sort(previous.begin(), previous.end(), ByPath);
+
+	CatalogWalk walk;
+	walk.root = catalog->root;
+	walk.pending.push_back(string());
+	walk.visited.insert(fs::canonical(walk.root, error).string());
+	{
+		vector<std::thread> workers;
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(WalkWorker, &walk));
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+	sort(walk.found.begin(), walk.found.end(), ByPath);
+
+	// reuse metadata for files whose size and mtime are unchanged
+	vector<size_t> changed;
+	size_t old = 0;
+	for (size_t i = 0; i < walk.found.size(); i++)
+	{
+		CatalogEntry &entry = walk.found[i];
+		while (old < previous.size() && previous[old].path < entry.path)
+		{
+			old++;
+			catalog->removed++;
+		}
+
+		if (old < previous.size() && previous[old].path == entry.path
+			&& previous[old].size == entry.size && previous[old].mtime == entry.mtime)
+			entry = previous[old++];
+		else
+		{
+			if (old < previous.size() && previous[old].path == entry.path) old++;
+			changed.push_back(i);
+		}
+	}
+	catalog->removed += int(previous.size() - old);
+
+	// probe the rest in parallel
+	{
+		atomic<size_t> next(0);
+		auto probe = [&]() {
+			for (size_t k = next++; k < changed.size(); k = next++)
+				ProbeEntry(catalog->root, &walk.found[changed[k]]);
+		};
+		vector<std::thread> workers;
+		int count = min(threads, int(changed.size()));
+		for (int i = 0; i < count; i++)
+			workers.push_back(std::thread(probe));
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+	catalog->probed = int(changed.size());
+
+	// the index remembers undecodable files too; navigation does not
+	if (!haveIndex || catalog->probed > 0 || catalog->removed > 0)
+		SaveIndex(indexFile, walk.found);
+
+	catalog->entries.reserve(walk.found.size());
+	for (size_t i = 0; i < walk.found.size(); i++)
+		if (walk.found[i].width > 0) catalog->entries.push_back(walk.found[i]);
+
+	catalog->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Catalog " << catalog->root << ": " << catalog->entries.size() << " images ("
+		<< catalog->probed << " probed, " << catalog->removed << " removed) in "
+		<< catalog->seconds * 1000.0 << " ms" << endl;
+	return true;
+}
+
+string CatalogFile(const Catalog *catalog, int index)
+{
+	if (index < 0 || index >= int(catalog->entries.size()))
+		return string();
+	return catalog->root + "/" + catalog->entries[index].path;
+}
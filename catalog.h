@@ -0,0 +1,53 @@
+// ==========================================================================
+// Image catalog
+//
+// Indexes every image under a directory tree and keeps the result in a
+// compact binary file (<root>/.catalog.idx). A rescan walks the tree in
+// parallel but only re-probes files whose size or modification time changed
+// since the index was written, so reopening a large directory costs a
+// directory walk rather than reading every image header.
+// ==========================================================================
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+enum CatalogFormat { CATALOG_UNKNOWN = 0, CATALOG_PNG, CATALOG_JPEG, CATALOG_BMP, CATALOG_TGA };
+
+struct CatalogEntry
+{
+	std::string path;		// relative to the catalog root, '/' separated
+	int width, height, channels;
+	int format;				// CatalogFormat
+	uint64_t size;			// bytes
+	int64_t mtime;			// filesystem clock ticks, only compared for equality
+	uint64_t hash;			// FNV-1a 64 of the file contents
+
+	CatalogEntry() : width(0), height(0), channels(0), format(CATALOG_UNKNOWN),
+		size(0), mtime(0), hash(0)
+	{}
+};
+
+struct Catalog
+{
+	std::string root;
+	std::vector<CatalogEntry> entries;	// sorted by path
+
+	// what the last OpenCatalog did
+	int probed, removed;
+	double seconds;
+
+	Catalog() : probed(0), removed(0), seconds(0.0)
+	{}
+};
+
+// loads the index for root, rescans the tree and rewrites the index if
+// anything changed; returns false if root is not a readable directory
+bool OpenCatalog(Catalog *catalog, const char *root, int threads = 0);
+
+// full path of entry index, suitable for InitializeTexture
+std::string CatalogFile(const Catalog *catalog, int index);
+
+#endif
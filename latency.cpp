@@ -0,0 +1,124 @@
+// ==========================================================================
+// Input-to-present latency measurement
+// ==========================================================================
+
+#include "latency.h"
+
+#include <iostream>
+#include <algorithm>
+
+#include <GLFW/glfw3.h>
+
+using namespace std;
+
+static const GLuint64 fenceTimeout = 100000000;		// 100 ms, in nanoseconds
+
+// creates the timestamp queries and relates the GPU clock to glfwGetTime,
+// taking the host time on either side of the GPU clock read
+static void CalibrateClock(FrameLatency *latency)
+{
+	glGenQueries(LATENCY_MAX_FRAMES, latency->queries);
+
+	GLint64 gpuTime = 0;
+	double before = glfwGetTime();
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	double after = glfwGetTime();
+	latency->clockOffset = 0.5 * (before + after) - gpuTime * 1e-9;
+}
+
+// retires the oldest frame in flight, logging its latency; with wait false
+// it only retires a frame whose fence has already signalled. The sample
+// comes from the frame's timestamp, not from when this runs, so how late a
+// fence is noticed does not bias either mode
+static bool RetireFrame(FrameLatency *latency, bool wait)
+{
+	if (latency->count == 0) return false;
+
+	int slot = latency->first;
+	GLenum status = glClientWaitSync(latency->fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT,
+		wait ? fenceTimeout : 0);
+	if (status == GL_TIMEOUT_EXPIRED && !wait)
+		return false;
+
+	// a timed-out wait still retires the frame so the ring keeps moving;
+	// its sample is dropped rather than recorded as 100 ms
+	if ((status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+		&& latency->inputTimes[slot] >= 0.0)
+	{
+		// the query was issued before the fence, so its result is ready
+		GLuint64 gpuTime = 0;
+		glGetQueryObjectui64v(latency->queries[slot], GL_QUERY_RESULT, &gpuTime);
+		double complete = gpuTime * 1e-9 + latency->clockOffset;
+		latency->samples[latency->modes[slot]].push_back(complete - latency->inputTimes[slot]);
+	}
+
+	glDeleteSync(latency->fences[slot]);
+	latency->fences[slot] = 0;
+	latency->first = (latency->first + 1) % LATENCY_MAX_FRAMES;
+	latency->count--;
+	return true;
+}
+
+void SetLowLatency(FrameLatency *latency, bool enabled)
+{
+	latency->lowLatency = enabled;
+	glfwSwapInterval(enabled ? latency->lowSwapInterval : 1);
+}
+
+void FinishLatencyFrame(FrameLatency *latency, double inputTime)
+{
+	// make room in the ring; only normal mode can get here with it full
+	if (latency->count == LATENCY_MAX_FRAMES)
+		RetireFrame(latency, true);
+
+	if (latency->queries[0] == 0)
+		CalibrateClock(latency);
+
+	int slot = (latency->first + latency->count) % LATENCY_MAX_FRAMES;
+	glQueryCounter(latency->queries[slot], GL_TIMESTAMP);
+	latency->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	latency->inputTimes[slot] = inputTime;
+	latency->modes[slot] = latency->lowLatency ? LATENCY_LOW : LATENCY_NORMAL;
+	latency->count++;
+
+	// log whatever has already completed, then wait until no more frames
+	// are queued than the mode allows
+	while (RetireFrame(latency, false))
+		;
+	int allowed = latency->lowLatency ? 0 : LATENCY_MAX_FRAMES - 1;
+	while (latency->count > allowed)
+		RetireFrame(latency, true);
+}
+
+void ReportLatency(const FrameLatency *latency)
+{
+	static const char *names[LATENCY_MODE_COUNT] = { "normal", "low-latency" };
+
+	for (int mode = 0; mode < LATENCY_MODE_COUNT; mode++)
+	{
+		vector<double> sorted = latency->samples[mode];
+		if (sorted.empty()) continue;
+		sort(sorted.begin(), sorted.end());
+
+		double total = 0.0;
+		for (size_t i = 0; i < sorted.size(); i++) total += sorted[i];
+		auto percentile = [&sorted](double p) {
+			return sorted[min(sorted.size() - 1, size_t(p * sorted.size()))] * 1000.0;
+		};
+
+		cout << "Input-to-present latency, " << names[mode] << " mode (" << sorted.size()
+			<< " frames): mean " << total / sorted.size() * 1000.0
+			<< " ms, p50 " << percentile(0.50) << ", p90 " << percentile(0.90)
+			<< ", p99 " << percentile(0.99) << ", max " << sorted.back() * 1000.0 << endl;
+	}
+}
+
+void DestroyFrameLatency(FrameLatency *latency)
+{
+	while (RetireFrame(latency, true))
+		;
+	if (latency->queries[0])
+		glDeleteQueries(LATENCY_MAX_FRAMES, latency->queries);
+	for (int i = 0; i < LATENCY_MAX_FRAMES; i++)
+		latency->queries[i] = 0;
+}
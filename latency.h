@@ -0,0 +1,67 @@
+// ==========================================================================
+// Input-to-present latency measurement
+//
+// Every frame that consumes new input (a drag of the image) records the
+// time that input was sampled. A GPU timestamp query and a fence follow the
+// frame's buffer swap; the timestamp, mapped onto glfwGetTime's clock, is
+// when the frame's commands completed, so both modes are measured the same
+// way no matter when their fences happen to be checked. Fences also bound
+// the number of frames the driver may queue: one in low-latency mode, so
+// input is never sampled more than a frame ahead of the display.
+// ==========================================================================
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#define LATENCY_MAX_FRAMES	4	// frames allowed in flight in normal mode
+
+enum LatencyMode { LATENCY_NORMAL = 0, LATENCY_LOW, LATENCY_MODE_COUNT };
+
+struct FrameLatency
+{
+	bool lowLatency;
+	int lowSwapInterval;		// swap interval used in low-latency mode
+
+	// frames submitted but not yet known to be complete, oldest first
+	GLsync fences[LATENCY_MAX_FRAMES];
+	GLuint queries[LATENCY_MAX_FRAMES];		// GL_TIMESTAMP after each swap
+	double inputTimes[LATENCY_MAX_FRAMES];	// negative if the frame had no new input
+	int modes[LATENCY_MAX_FRAMES];
+	int first, count;
+
+	// glfwGetTime() minus GPU time, measured once when the queries are created
+	double clockOffset;
+
+	// input-to-swap-complete latencies in seconds, per LatencyMode
+	std::vector<double> samples[LATENCY_MODE_COUNT];
+
+	FrameLatency() : lowLatency(false), lowSwapInterval(0), first(0), count(0), clockOffset(0.0)
+	{
+		for (int i = 0; i < LATENCY_MAX_FRAMES; i++)
+		{
+			fences[i] = 0;
+			queries[i] = 0;
+			inputTimes[i] = -1.0;
+			modes[i] = LATENCY_NORMAL;
+		}
+	}
+};
+
+// switches mode and applies the matching swap interval (1 in normal mode)
+void SetLowLatency(FrameLatency *latency, bool enabled);
+
+// call right after glfwSwapBuffers; inputTime is when the input drawn in
+// this frame was sampled (glfwGetTime), or negative if there was none.
+// Blocks while more frames are in flight than the mode allows.
+void FinishLatencyFrame(FrameLatency *latency, double inputTime);
+
+// prints the latency distribution of each mode that has samples
+void ReportLatency(const FrameLatency *latency);
+
+// waits for outstanding frames and deletes their fences and queries
+void DestroyFrameLatency(FrameLatency *latency);
+
+#endif
@@ -0,0 +1,383 @@
+// ==========================================================================
+// Image-sequence playback
+//
+// Decode workers claim sequence indices in order and write each decoded
+// frame into slot (index % PLAYBACK_RING_SIZE); a worker waits while the slot
+// it needs still holds an unpresented frame, which bounds memory to the ring.
+// Once the clock is running a worker never claims a frame that will already
+// be overdue when it finishes decoding, so slow decoding drops frames rather
+// than slowing playback down. The render thread picks the newest ready frame
+// that is due, drops anything older, and uploads it through the next PBO in
+// the ring.
+// ==========================================================================
+
+#include "playback.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cctype>
+
+#include "stb_image.h"
+
+using namespace std;
+
+bool CheckGLErrors();
+
+// --------------------------------------------------------------------------
+// Timing helpers
+
+double PlaybackClock()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyStat::Add(double seconds)
+{
+	if (count == 0 || seconds < min) min = seconds;
+	if (count == 0 || seconds > max) max = seconds;
+	total += seconds;
+	count++;
+}
+
+// --------------------------------------------------------------------------
+// Decode thread pool
+
+static FrameSlot &SlotFor(Playback *playback, int frame)
+{
+	return playback->slots[frame % PLAYBACK_RING_SIZE];
+}
+
+static void ReleaseSlot(FrameSlot *slot)
+{
+	if (slot->pixels) stbi_image_free(slot->pixels);
+	slot->pixels = 0;
+	slot->frame = -1;
+	slot->state = FrameSlot::EMPTY;
+}
+
+// first sequence index still worth decoding: the first one not yet due when a
+// decode started now is expected to finish (called with the lock held)
+static int FirstUsefulFrame(const Playback *playback)
+{
+	int first = playback->shownFrame + 1;
+	if (playback->shownFrame >= 0)
+	{
+		double finish = PlaybackClock() + playback->decode.Mean();
+		first = std::max(first, int(ceil((finish - playback->startTime) * playback->fps)));
+	}
+	return first;
+}
+
+static void DecodeWorker(Playback *playback)
+{
+	// frames are uploaded bottom row first, like InitializeTexture's images;
+	// set per thread so the result never depends on the global flag other
+	// loaders change on the main thread
+	stbi_set_flip_vertically_on_load_thread(1);
+
+	for (;;)
+	{
+		FrameSlot *slot = 0;
+		int frame = 0;
+
+		// claim the next frame once its ring slot is free
+		{
+			unique_lock<mutex> guard(playback->lock);
+			playback->wake.wait(guard, [playback] {
+				// frames skipped here are counted as dropped by the presenter,
+				// which sees the gap between the frames it shows
+				playback->nextDecode = std::max(playback->nextDecode, FirstUsefulFrame(playback));
+				return playback->stopping
+					|| SlotFor(playback, playback->nextDecode).state == FrameSlot::EMPTY;
+			});
+			if (playback->stopping) return;
+
+			frame = playback->nextDecode++;
+			slot = &SlotFor(playback, frame);
+			slot->state = FrameSlot::DECODING;
+			slot->frame = frame;
+		}
+
+		char filename[300];
+		snprintf(filename, sizeof(filename), playback->pattern,
+			playback->firstFrame + frame % playback->frameCount);
+
+		double begin = PlaybackClock();
+		int width = 0, height = 0, channels = 0;
+		unsigned char *pixels = stbi_load(filename, &width, &height, &channels, 4);
+		double elapsed = PlaybackClock() - begin;
+
+		if (!pixels)
+			cout << "ERROR: Could not decode frame " << filename << endl;
+
+		{
+			lock_guard<mutex> guard(playback->lock);
+			slot->pixels = pixels;
+			slot->width = width;
+			slot->height = height;
+			slot->decodeTime = elapsed;
+			slot->state = FrameSlot::READY;
+			playback->decode.Add(elapsed);
+
+			// finished too late to be shown; hand the slot straight back
+			if (frame <= playback->shownFrame) ReleaseSlot(slot);
+		}
+		playback->wake.notify_all();
+	}
+}
+
+// --------------------------------------------------------------------------
+// GPU upload through the PBO ring
+
+static void UploadFrame(Playback *playback, const FrameSlot *slot)
+{
+	MyTexture *texture = &playback->texture;
+	GLsizeiptr size = GLsizeiptr(slot->width) * slot->height * 4;
+
+	glBindTexture(GL_TEXTURE_RECTANGLE, texture->textureID);
+
+	// storage is only (re)allocated when the frame size changes
+	if (texture->width != slot->width || texture->height != slot->height)
+	{
+		texture->width = slot->width;
+		texture->height = slot->height;
+		glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, slot->width, slot->height,
+			0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, playback->pbo[playback->pboIndex]);
+	playback->pboIndex = (playback->pboIndex + 1) % PLAYBACK_PBO_COUNT;
+
+	// orphan the buffer's previous storage so we never wait on a transfer
+	// the driver has not finished with
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+	void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (mapped)
+	{
+		memcpy(mapped, slot->pixels, size);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		// sources from the bound PBO, offset 0
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, 0, 0, slot->width, slot->height,
+			GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+	else
+		cout << "ERROR: Could not map pixel buffer for frame " << slot->frame << endl;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	CheckGLErrors();
+}
+
+// --------------------------------------------------------------------------
+// Frame file names
+
+// the pattern is used as a printf format, so it must take exactly one int:
+// a single %d / %i / %u with optional flags, width and precision, and
+// otherwise only %%
+static bool ValidFramePattern(const char *pattern)
+{
+	int conversions = 0;
+	for (const char *c = pattern; *c; c++)
+	{
+		if (*c != '%') continue;
+		if (*++c == '%') continue;
+
+		while (*c && strchr("-+ #0", *c)) c++;
+		while (isdigit((unsigned char)*c)) c++;
+		if (*c == '.')
+			for (c++; isdigit((unsigned char)*c); c++) {}
+		if (*c != 'd' && *c != 'i' && *c != 'u') return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+// --------------------------------------------------------------------------
+// Public interface
+
+bool InitializePlayback(Playback *playback, const char *pattern, float fps, int threads)
+{
+	if (!ValidFramePattern(pattern))
+	{
+		cout << "ERROR: Sequence pattern " << pattern
+			<< " must contain exactly one %d conversion (use %% for a literal %)" << endl;
+		return false;
+	}
+
+	strncpy(playback->pattern, pattern, sizeof(playback->pattern) - 1);
+	playback->pattern[sizeof(playback->pattern) - 1] = '\0';
+	playback->fps = fps > 0.f ? fps : 30.f;
+
+	// sequences may be numbered from 0 or 1; count consecutive files on disk
+	char filename[300];
+	for (int first = 0; first <= 1 && playback->frameCount == 0; first++)
+	{
+		playback->firstFrame = first;
+		for (; playback->frameCount < PLAYBACK_MAX_FRAMES; playback->frameCount++)
+		{
+			snprintf(filename, sizeof(filename), pattern, first + playback->frameCount);
+			FILE *file = fopen(filename, "rb");
+			if (!file) break;
+			fclose(file);
+		}
+	}
+	if (playback->frameCount == 0)
+	{
+		cout << "ERROR: No frames found matching " << pattern << endl;
+		return false;
+	}
+
+	int width, height, channels;
+	snprintf(filename, sizeof(filename), pattern, playback->firstFrame);
+	if (!stbi_info(filename, &width, &height, &channels))
+	{
+		cout << "ERROR: Unsupported frame format " << filename << endl;
+		return false;
+	}
+	cout << "Playing " << playback->frameCount << " frames of " << width << "x" << height
+		<< " at " << playback->fps << " fps" << endl;
+
+	// GL objects; texture storage is allocated on the first upload
+	glGenBuffers(PLAYBACK_PBO_COUNT, playback->pbo);
+	glGenTextures(1, &playback->texture.textureID);
+	playback->texture.target = GL_TEXTURE_RECTANGLE;
+	glBindTexture(GL_TEXTURE_RECTANGLE, playback->texture.textureID);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// leave a core for the render thread, and keep at least two slots free
+	// so the presenter always has a frame ahead of the one being decoded
+	if (threads <= 0)
+		threads = int(std::thread::hardware_concurrency()) - 1;
+	threads = std::max(1, std::min(threads, PLAYBACK_RING_SIZE - 2));
+	for (int i = 0; i < threads; i++)
+		playback->workers.push_back(std::thread(DecodeWorker, playback));
+
+	return !CheckGLErrors();
+}
+
+bool UpdatePlayback(Playback *playback)
+{
+	double now = PlaybackClock();
+
+	FrameSlot *best = 0;
+	{
+		lock_guard<mutex> guard(playback->lock);
+
+		// the clock starts with the first frame that becomes available, so
+		// the initial decode is not counted as dropped frames
+		int due = -1;
+		if (playback->shownFrame >= 0)
+			due = int((now - playback->startTime) * playback->fps);
+		else
+			for (int i = 0; i < PLAYBACK_RING_SIZE; i++)
+				if (playback->slots[i].state == FrameSlot::READY
+					&& (due < 0 || playback->slots[i].frame < due))
+					due = playback->slots[i].frame;
+
+		for (int i = 0; i < PLAYBACK_RING_SIZE; i++)
+		{
+			FrameSlot *slot = &playback->slots[i];
+			if (slot->state == FrameSlot::READY && slot->pixels
+				&& slot->frame > playback->shownFrame && slot->frame <= due
+				&& (!best || slot->frame > best->frame))
+				best = slot;
+		}
+
+		// everything older than the chosen frame is dropped, as are failures
+		for (int i = 0; i < PLAYBACK_RING_SIZE; i++)
+		{
+			FrameSlot *slot = &playback->slots[i];
+			if (slot != best && slot->state == FrameSlot::READY && slot->frame <= due)
+				ReleaseSlot(slot);
+		}
+	}
+	if (!best)
+	{
+		playback->wake.notify_all();
+		return false;
+	}
+
+	// a READY slot is only ever released by this thread, so it is safe to
+	// read without holding the lock
+	double begin = PlaybackClock();
+	UploadFrame(playback, best);
+	playback->upload.Add(PlaybackClock() - begin);
+
+	{
+		// the workers read startTime to decide which frames to skip
+		lock_guard<mutex> guard(playback->lock);
+		if (playback->shownFrame < 0)
+			playback->startTime = now - best->frame / playback->fps;
+		else
+			playback->dropped += best->frame - playback->shownFrame - 1;
+
+		playback->shownDue = playback->startTime + best->frame / playback->fps;
+		playback->pendingPresent = true;
+		playback->presented++;
+		playback->shownFrame = best->frame;
+		ReleaseSlot(best);
+	}
+	playback->wake.notify_all();
+
+	return true;
+}
+
+void NotePlaybackPresented(Playback *playback)
+{
+	if (!playback->pendingPresent) return;
+	playback->pendingPresent = false;
+	playback->present.Add(std::max(0.0, PlaybackClock() - playback->shownDue));
+}
+
+static void PrintLatency(const char *name, const LatencyStat &stat)
+{
+	cout << "  " << name << " ms: mean " << stat.Mean()*1000.0
+		<< ", min " << stat.min*1000.0 << ", max " << stat.max*1000.0
+		<< " (" << stat.count << " samples)" << endl;
+}
+
+void ReportPlayback(const Playback *playback)
+{
+	double elapsed = playback->shownFrame >= 0 ? PlaybackClock() - playback->startTime : 0.0;
+
+	cout << "Playback: " << playback->presented << " frames presented, "
+		<< playback->dropped << " dropped";
+	if (elapsed > 0.0)
+		cout << ", " << playback->presented / elapsed << " fps achieved of "
+			<< playback->fps << " requested";
+	cout << endl;
+
+	PrintLatency("decode ", playback->decode);
+	PrintLatency("upload ", playback->upload);
+	PrintLatency("present", playback->present);
+}
+
+void DestroyPlayback(Playback *playback)
+{
+	{
+		lock_guard<mutex> guard(playback->lock);
+		playback->stopping = true;
+	}
+	playback->wake.notify_all();
+	for (size_t i = 0; i < playback->workers.size(); i++)
+		playback->workers[i].join();
+	playback->workers.clear();
+
+	for (int i = 0; i < PLAYBACK_RING_SIZE; i++)
+		ReleaseSlot(&playback->slots[i]);
+
+	glDeleteBuffers(PLAYBACK_PBO_COUNT, playback->pbo);
+	glDeleteTextures(1, &playback->texture.textureID);
+	for (int i = 0; i < PLAYBACK_PBO_COUNT; i++) playback->pbo[i] = 0;
+	playback->texture = MyTexture();
+}
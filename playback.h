@@ -0,0 +1,113 @@
+// ==========================================================================
+// Image-sequence playback
+//
+// Plays a numbered sequence of PNG/JPEG frames (e.g. "./frames/f%04d.png")
+// at a target frame rate. Frames are decoded ahead of time on a pool of
+// worker threads into a bounded ring of buffers, streamed to the GPU through
+// a ring of orphaned pixel buffer objects and copied into a single reused
+// rectangle texture, so the render loop never waits on file I/O or decoding.
+// ==========================================================================
+#ifndef PLAYBACK_H
+#define PLAYBACK_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <glad/glad.h>
+#include "texture.h"
+
+#define PLAYBACK_RING_SIZE	8	// decoded frames held in memory at most
+#define PLAYBACK_PBO_COUNT	3	// pixel unpack buffers cycled for uploads
+#define PLAYBACK_MAX_FRAMES	1000000	// longest sequence probed on disk
+
+// running min / mean / max of one latency, in seconds
+struct LatencyStat
+{
+	double total, min, max;
+	int count;
+
+	LatencyStat() : total(0.0), min(0.0), max(0.0), count(0)
+	{}
+
+	void Add(double seconds);
+	double Mean() const { return count ? total/count : 0.0; }
+};
+
+// one decoded frame waiting in the ring
+struct FrameSlot
+{
+	enum State { EMPTY, DECODING, READY };
+
+	State state;
+	int frame;				// sequence index (not file number) held by this slot
+	unsigned char *pixels;	// RGBA8 bottom row first, owned by stb_image
+	int width, height;
+	double decodeTime;
+
+	FrameSlot() : state(EMPTY), frame(-1), pixels(0), width(0), height(0), decodeTime(0.0)
+	{}
+};
+
+struct Playback
+{
+	// sequence description
+	char pattern[256];		// printf pattern taking the frame number (one %d)
+	int firstFrame;			// file number of the first frame
+	int frameCount;			// number of consecutive frames found on disk
+	float fps;
+
+	// decode thread pool and the bounded ring it fills
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake;
+	FrameSlot slots[PLAYBACK_RING_SIZE];
+	int nextDecode;			// next sequence index a worker will claim
+	int shownFrame;			// sequence index currently in the texture
+	bool stopping;
+
+	// GPU side: PBO ring feeding one reused texture
+	GLuint pbo[PLAYBACK_PBO_COUNT];
+	int pboIndex;
+	MyTexture texture;
+
+	// timing and accounting
+	double startTime;
+	double shownDue;		// time the frame in the texture was due on screen
+	bool pendingPresent;	// texture changed since the last buffer swap
+	int presented, dropped;
+	LatencyStat decode, upload, present;
+
+	Playback() : firstFrame(0), frameCount(0), fps(30.f), nextDecode(0), shownFrame(-1),
+		stopping(false), pboIndex(0), startTime(0.0), shownDue(0.0),
+		pendingPresent(false), presented(0), dropped(0)
+	{
+		pattern[0] = '\0';
+		for (int i = 0; i < PLAYBACK_PBO_COUNT; i++) pbo[i] = 0;
+	}
+};
+
+// seconds on a monotonic clock, usable from any thread
+double PlaybackClock();
+
+// finds the frames matching pattern, starts the decode pool and creates the
+// GL objects; requires a current context, returns false if the pattern does
+// not take exactly one integer or no frame exists
+bool InitializePlayback(Playback *playback, const char *pattern, float fps, int threads = 0);
+
+// uploads the newest decoded frame that is due at the current time, dropping
+// any older ones; returns true if the texture changed
+bool UpdatePlayback(Playback *playback);
+
+// records that the frame in the texture has reached the screen (call after
+// the buffer swap that displayed it)
+void NotePlaybackPresented(Playback *playback);
+
+// prints frame counts and decode / upload / present latencies
+void ReportPlayback(const Playback *playback);
+
+// stops the decode pool and releases every buffer and GL object
+void DestroyPlayback(Playback *playback);
+
+#endif
@@ -0,0 +1,237 @@
+// ==========================================================================
+// Summed-area tables on the GPU
+// ==========================================================================
+
+#include "sat.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+bool CheckGLErrors();
+string LoadSource(const string &filename);
+GLuint CompileShader(GLenum shaderType, const string &source);
+GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader);
+
+// texture units used while building and filtering
+#define SAT_UNIT_SUMS		1
+#define SAT_UNIT_SQUARES	2
+
+// --------------------------------------------------------------------------
+// Table storage
+
+static void CreateIntegerTexture(GLuint texture, GLenum internalFormat, GLenum format,
+	int width, int height)
+{
+	// integer textures are only complete with nearest filtering
+	glBindTexture(GL_TEXTURE_RECTANGLE, texture);
+	glTexImage2D(GL_TEXTURE_RECTANGLE, 0, internalFormat, width, height, 0,
+		format, GL_UNSIGNED_INT, 0);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static bool AllocateTables(SummedAreaTable *sat, int width, int height)
+{
+	glDeleteTextures(2, sat->sums);
+	glDeleteTextures(2, sat->squares);
+	glGenTextures(2, sat->sums);
+	glGenTextures(2, sat->squares);
+
+	const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	bool complete = true;
+	for (int i = 0; i < 2; i++)
+	{
+		CreateIntegerTexture(sat->sums[i], GL_RGBA32UI, GL_RGBA_INTEGER, width, height);
+		CreateIntegerTexture(sat->squares[i], GL_RG32UI, GL_RG_INTEGER, width, height);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, sat->framebuffers[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE, sat->sums[i], 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_RECTANGLE, sat->squares[i], 0);
+		glDrawBuffers(2, drawBuffers);
+		complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+
+	// a zero size makes the next image reallocate instead of reusing these
+	sat->width = complete ? width : 0;
+	sat->height = complete ? height : 0;
+	if (!complete)
+		cout << "ERROR: Summed-area table framebuffer is incomplete for "
+			<< width << "x" << height << endl;
+	return complete;
+}
+
+// --------------------------------------------------------------------------
+// Prefix-sum passes
+
+// adds the texel `shift` behind to every texel, reading the current table
+// and writing the other one
+static void ScanPass(SummedAreaTable *sat, int shiftX, int shiftY)
+{
+	int read = sat->current, write = 1 - sat->current;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, sat->framebuffers[write]);
+	glActiveTexture(GL_TEXTURE0 + SAT_UNIT_SUMS);
+	glBindTexture(GL_TEXTURE_RECTANGLE, sat->sums[read]);
+	glActiveTexture(GL_TEXTURE0 + SAT_UNIT_SQUARES);
+	glBindTexture(GL_TEXTURE_RECTANGLE, sat->squares[read]);
+
+	glUniform1i(glGetUniformLocation(sat->scanProgram, "pass"), sat->passes);
+	glUniform2i(glGetUniformLocation(sat->scanProgram, "shift"), shiftX, shiftY);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	sat->current = write;
+	sat->passes++;
+}
+
+static void BuildTable(SummedAreaTable *sat, const MyTexture &source)
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	glViewport(0, 0, source.width, source.height);
+	glUseProgram(sat->scanProgram);
+	glBindVertexArray(sat->quadArray);
+	glUniform1i(glGetUniformLocation(sat->scanProgram, "s"), 0);
+	glUniform1i(glGetUniformLocation(sat->scanProgram, "sums"), SAT_UNIT_SUMS);
+	glUniform1i(glGetUniformLocation(sat->scanProgram, "squares"), SAT_UNIT_SQUARES);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_RECTANGLE, source.textureID);
+
+	// pass 0 converts the source into table 0; nothing of the table may be
+	// bound for reading while it is being written
+	glActiveTexture(GL_TEXTURE0 + SAT_UNIT_SUMS);
+	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	glActiveTexture(GL_TEXTURE0 + SAT_UNIT_SQUARES);
+	glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, sat->framebuffers[0]);
+	glUniform1i(glGetUniformLocation(sat->scanProgram, "pass"), 0);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	sat->current = 0;
+	sat->passes = 1;
+
+	// log2(width) passes along rows, then log2(height) along columns
+	for (int shift = 1; shift < source.width; shift *= 2)
+		ScanPass(sat, shift, 0);
+	for (int shift = 1; shift < source.height; shift *= 2)
+		ScanPass(sat, 0, shift);
+
+	// restore the state the render loop expects
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	glBindVertexArray(0);
+	glUseProgram(0);
+	glActiveTexture(GL_TEXTURE0);
+
+	CheckGLErrors();
+}
+
+// --------------------------------------------------------------------------
+// Public interface
+
+// LinkProgram reports failures but still returns the program object
+static bool ProgramLinked(GLuint program)
+{
+	GLint status = GL_FALSE;
+	if (program) glGetProgramiv(program, GL_LINK_STATUS, &status);
+	return status == GL_TRUE;
+}
+
+bool InitializeSummedAreaTable(SummedAreaTable *sat)
+{
+	string vertexSource = LoadSource("shaders/vertex.glsl");
+	string scanSource = LoadSource("shaders/sat_scan.glsl");
+	string filterSource = LoadSource("shaders/sat_filter.glsl");
+	if (vertexSource.empty() || scanSource.empty() || filterSource.empty()) return false;
+
+	GLuint vertex = CompileShader(GL_VERTEX_SHADER, vertexSource);
+	GLuint scan = CompileShader(GL_FRAGMENT_SHADER, scanSource);
+	GLuint filter = CompileShader(GL_FRAGMENT_SHADER, filterSource);
+	sat->scanProgram = LinkProgram(vertex, scan);
+	sat->filterProgram = LinkProgram(vertex, filter);
+	glDeleteShader(vertex);
+	glDeleteShader(scan);
+	glDeleteShader(filter);
+
+	// a zero filterProgram tells the caller the filters are unavailable
+	if (!ProgramLinked(sat->scanProgram) || !ProgramLinked(sat->filterProgram))
+	{
+		glDeleteProgram(sat->scanProgram);
+		glDeleteProgram(sat->filterProgram);
+		sat->scanProgram = sat->filterProgram = 0;
+		return false;
+	}
+
+	// a quad covering the viewport; the scan pass works from gl_FragCoord
+	const GLfloat corners[] = { -1.f, -1.f,  1.f, -1.f,  -1.f, 1.f,  1.f, 1.f };
+	glGenVertexArrays(1, &sat->quadArray);
+	glGenBuffers(1, &sat->quadBuffer);
+	glBindVertexArray(sat->quadArray);
+	glBindBuffer(GL_ARRAY_BUFFER, sat->quadBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), 0);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+
+	glGenFramebuffers(2, sat->framebuffers);
+
+	return !CheckGLErrors();
+}
+
+bool UpdateSummedAreaTable(SummedAreaTable *sat, const MyTexture &source, int version)
+{
+	if (source.textureID == 0 || source.width <= 0 || source.height <= 0) return false;
+
+	// a failed image is not retried every frame, only once it changes
+	if (source.textureID == sat->source && version == sat->version)
+		return sat->ready;
+	sat->source = source.textureID;
+	sat->version = version;
+	sat->ready = false;
+
+	if ((source.width != sat->width || source.height != sat->height)
+		&& !AllocateTables(sat, source.width, source.height))
+		return false;
+
+	BuildTable(sat, source);
+	sat->ready = true;
+	return true;
+}
+
+void BindSummedAreaTable(const SummedAreaTable *sat, int mode, int radius)
+{
+	glActiveTexture(GL_TEXTURE0 + SAT_UNIT_SUMS);
+	glBindTexture(GL_TEXTURE_RECTANGLE, sat->sums[sat->current]);
+	glActiveTexture(GL_TEXTURE0 + SAT_UNIT_SQUARES);
+	glBindTexture(GL_TEXTURE_RECTANGLE, sat->squares[sat->current]);
+	glActiveTexture(GL_TEXTURE0);
+
+	GLuint program = sat->filterProgram;
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "s"), 0);
+	glUniform1i(glGetUniformLocation(program, "sums"), SAT_UNIT_SUMS);
+	glUniform1i(glGetUniformLocation(program, "squares"), SAT_UNIT_SQUARES);
+	glUniform1i(glGetUniformLocation(program, "mode"), mode);
+	glUniform1i(glGetUniformLocation(program, "radius"), radius);
+	glUniform1f(glGetUniformLocation(program, "k"), 0.2f);
+	glUseProgram(0);
+}
+
+void DestroySummedAreaTable(SummedAreaTable *sat)
+{
+	glDeleteTextures(2, sat->sums);
+	glDeleteTextures(2, sat->squares);
+	glDeleteFramebuffers(2, sat->framebuffers);
+	glDeleteBuffers(1, &sat->quadBuffer);
+	glDeleteVertexArrays(1, &sat->quadArray);
+	glDeleteProgram(sat->scanProgram);
+	glDeleteProgram(sat->filterProgram);
+	*sat = SummedAreaTable();
+}
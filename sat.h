@@ -0,0 +1,66 @@
+// ==========================================================================
+// Summed-area tables on the GPU
+//
+// Builds the integral image of a texture with log-step prefix-sum passes
+// (Hillis-Steele: each pass adds the value 2^k texels back, first along rows
+// then along columns), after which any box sum costs four fetches. Filters
+// of any radius - box blur, local variance, adaptive threshold - are drawn
+// with sat_filter.glsl.
+//
+// Sums are kept in unsigned integer textures of 8-bit values. Unsigned
+// arithmetic wraps, so a window sum D - B - C + A is exact whenever the true
+// sum fits in 32 bits, whatever the size of the image:
+//   sums     RGBA32UI  R, G, B and luminance
+//   squares  RG32UI    luminance squared as a 64-bit (low, high) pair
+// ==========================================================================
+#ifndef SAT_H
+#define SAT_H
+
+#include <glad/glad.h>
+#include "texture.h"
+
+// filter modes drawn from the table, numbered after fragment.glsl's 0-3
+#define SAT_MODE_BOX_BLUR	4
+#define SAT_MODE_VARIANCE	5
+#define SAT_MODE_THRESHOLD	6
+
+struct SummedAreaTable
+{
+	// ping-pong pairs; current is the index holding the finished table
+	GLuint sums[2], squares[2];
+	GLuint framebuffers[2];
+	int current;
+	int width, height;
+
+	// what the table was last built from, so it is only rebuilt on change,
+	// and whether that build succeeded
+	GLuint source;
+	int version;
+	bool ready;
+
+	GLuint scanProgram, filterProgram;
+	GLuint quadArray, quadBuffer;
+	int passes;					// prefix-sum passes in the last build
+
+	SummedAreaTable() : current(0), width(0), height(0), source(0), version(-1), ready(false),
+		scanProgram(0), filterProgram(0), quadArray(0), quadBuffer(0), passes(0)
+	{
+		for (int i = 0; i < 2; i++) sums[i] = squares[i] = framebuffers[i] = 0;
+	}
+};
+
+// compiles the scan and filter programs; returns false on failure
+bool InitializeSummedAreaTable(SummedAreaTable *sat);
+
+// rebuilds the table if source or version differ from the last build;
+// callers bump version whenever the texture's contents change. Returns
+// false if no table could be built for this source.
+bool UpdateSummedAreaTable(SummedAreaTable *sat, const MyTexture &source, int version);
+
+// makes filterProgram draw the given mode and radius from the table; the
+// source stays bound to unit 0 and the tables go on units 1 and 2
+void BindSummedAreaTable(const SummedAreaTable *sat, int mode, int radius);
+
+void DestroySummedAreaTable(SummedAreaTable *sat);
+
+#endif
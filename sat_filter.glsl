@@ -0,0 +1,81 @@
+// ==========================================================================
+// Neighbourhood filters served from a summed-area table
+//
+// Every box sum is four fetches from the table regardless of radius.
+// ==========================================================================
+#version 410
+
+in vec2 Texcoord;
+
+out vec4 outColor;
+
+uniform sampler2DRect s;
+uniform usampler2DRect sums;
+uniform usampler2DRect squares;
+
+/*
+modes : 4       - box blur
+        5       - local standard deviation (contrast map)
+        6       - adaptive threshold (Sauvola)
+*/
+uniform int mode;
+uniform int radius;
+uniform float k;		// threshold sensitivity
+
+// table entries left of or below the image are zero
+uvec4 SumAt(ivec2 p)
+{
+    return (p.x < 0 || p.y < 0) ? uvec4(0u) : texelFetch(sums, p);
+}
+
+uvec2 SquareAt(ivec2 p)
+{
+    return (p.x < 0 || p.y < 0) ? uvec2(0u) : texelFetch(squares, p).xy;
+}
+
+// 64-bit arithmetic on (low, high) pairs
+uvec2 Add64(uvec2 a, uvec2 b)
+{
+    uint low = a.x + b.x;
+    return uvec2(low, a.y + b.y + (low < a.x ? 1u : 0u));
+}
+
+uvec2 Sub64(uvec2 a, uvec2 b)
+{
+    return uvec2(a.x - b.x, a.y - b.y - (a.x < b.x ? 1u : 0u));
+}
+
+void main(void)
+{
+    ivec2 size = textureSize(sums);
+    ivec2 p = clamp(ivec2(floor(Texcoord)), ivec2(0), size - 1);
+
+    // window [lo + 1, hi], clipped to the image
+    ivec2 lo = max(p - radius, ivec2(0)) - 1;
+    ivec2 hi = min(p + radius, size - 1);
+    float area = float(hi.x - lo.x) * float(hi.y - lo.y);
+
+    uvec4 total = SumAt(hi) - SumAt(ivec2(lo.x, hi.y)) - SumAt(ivec2(hi.x, lo.y)) + SumAt(lo);
+    vec4 mean = vec4(total) / (255.0 * area);
+
+    if (mode == 4) {
+        outColor = vec4(mean.rgb, texelFetch(s, p).a);
+        return;
+    }
+
+    uvec2 squareSum = Sub64(Add64(SquareAt(hi), SquareAt(lo)),
+                            Add64(SquareAt(ivec2(lo.x, hi.y)), SquareAt(ivec2(hi.x, lo.y))));
+    float meanSquare = (float(squareSum.y) * 4294967296.0 + float(squareSum.x)) / (255.0 * 255.0 * area);
+    float deviation = sqrt(max(meanSquare - mean.a * mean.a, 0.0));
+
+    if (mode == 5) {
+        // deviation of 8-bit luminance peaks at 0.5; stretch for display
+        outColor = vec4(vec3(min(deviation * 4.0, 1.0)), 1.0);
+    }
+    else {
+        vec4 c = texelFetch(s, p);
+        float L = dot(c.rgb, vec3(0.299, 0.587, 0.114));
+        float threshold = mean.a * (1.0 + k * (deviation / 0.5 - 1.0));
+        outColor = vec4(vec3(L > threshold ? 1.0 : 0.0), 1.0);
+    }
+}
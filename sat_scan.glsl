@@ -0,0 +1,51 @@
+// ==========================================================================
+// Summed-area table prefix-sum pass
+//
+// Drawn over the whole table, one fragment per texel. The first pass turns
+// the source image into 8-bit integer values; every later pass adds the
+// value `shift` texels behind along a row or column (Hillis-Steele scan).
+// ==========================================================================
+#version 410
+
+// source image, read by the first pass only
+uniform sampler2DRect s;
+
+// table produced by the previous pass
+uniform usampler2DRect sums;
+uniform usampler2DRect squares;
+
+uniform int pass;
+uniform ivec2 shift;
+
+layout(location = 0) out uvec4 outSums;		// R, G, B, luminance
+layout(location = 1) out uvec2 outSquares;	// luminance^2 as (low, high)
+
+void main(void)
+{
+    ivec2 p = ivec2(gl_FragCoord.xy);
+
+    if (pass == 0) {
+        vec4 c = texelFetch(s, p);
+        uint L = uint(round(dot(c.rgb, vec3(0.299, 0.587, 0.114)) * 255.0));
+        outSums = uvec4(uvec3(round(c.rgb * 255.0)), L);
+        outSquares = uvec2(L * L, 0u);
+        return;
+    }
+
+    uvec4 sum = texelFetch(sums, p);
+    uvec2 square = texelFetch(squares, p).xy;
+
+    ivec2 q = p - shift;
+    if (q.x >= 0 && q.y >= 0) {
+        // 32-bit sums may wrap; window sums taken from them stay exact
+        sum += texelFetch(sums, q);
+
+        uvec2 other = texelFetch(squares, q).xy;
+        uint low = square.x + other.x;
+        square.y += other.y + (low < square.x ? 1u : 0u);
+        square.x = low;
+    }
+
+    outSums = sum;
+    outSquares = square;
+}
@@ -0,0 +1,448 @@
+// ==========================================================================
+// Bounded-memory streaming filter
+//
+// Both codecs report errors by longjmp, so every function that calls into
+// libpng or libjpeg arms its own setjmp before doing so. Interlaced PNGs
+// cannot be read a band at a time and are rejected; progressive JPEGs are
+// accepted, but libjpeg buffers their coefficients for the whole image.
+// ==========================================================================
+
+#include "stream.h"
+
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <csetjmp>
+#include <chrono>
+#include <vector>
+#include <string>
+
+#include <png.h>
+#include <jpeglib.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// CPU equivalent of fragment.glsl
+
+void FilterBand(unsigned char *pixels, int width, int rows, int mode)
+{
+	// same weights as the luminance() calls in fragment.glsl
+	static const float weights[4][3] = {
+		{ 0.f, 0.f, 0.f },
+		{ 0.333f, 0.333f, 0.333f },
+		{ 0.299f, 0.587f, 0.114f },
+		{ 0.213f, 0.715f, 0.072f }
+	};
+	if (mode < 1 || mode > 3) return;
+
+	const float *w = weights[mode];
+	size_t count = size_t(width) * rows;
+	for (size_t i = 0; i < count; i++, pixels += 4)
+	{
+		float L = pixels[0]*w[0] + pixels[1]*w[1] + pixels[2]*w[2];
+		unsigned char value = L >= 254.5f ? 255 : (unsigned char)(L + 0.5f);
+		pixels[0] = pixels[1] = pixels[2] = value;
+	}
+}
+
+// --------------------------------------------------------------------------
+// libjpeg error handling
+
+struct JpegError
+{
+	jpeg_error_mgr manager;
+	jmp_buf jump;
+};
+
+static void JpegErrorExit(j_common_ptr info)
+{
+	char message[JMSG_LENGTH_MAX];
+	(*info->err->format_message)(info, message);
+	cout << "ERROR: libjpeg: " << message << endl;
+	longjmp(((JpegError *)info->err)->jump, 1);
+}
+
+// --------------------------------------------------------------------------
+// Band reader: decodes PNG or JPEG scanlines to RGBA8
+
+struct BandReader
+{
+	enum Format { NONE, PNG, JPEG };
+
+	Format format;
+	FILE *file;
+	int width, height;
+
+	png_structp png;
+	png_infop pngInfo;
+
+	jpeg_decompress_struct jpeg;
+	JpegError jpegError;
+	vector<unsigned char> scanline;		// one RGB row for JPEG expansion
+
+	BandReader() : format(NONE), file(0), width(0), height(0), png(0), pngInfo(0), jpeg()
+	{}
+};
+
+static bool OpenPngReader(BandReader *reader)
+{
+	reader->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+	reader->pngInfo = reader->png ? png_create_info_struct(reader->png) : 0;
+	if (!reader->pngInfo) return false;
+	if (setjmp(png_jmpbuf(reader->png))) return false;
+
+	png_init_io(reader->png, reader->file);
+	png_read_info(reader->png, reader->pngInfo);
+
+	if (png_get_interlace_type(reader->png, reader->pngInfo) != PNG_INTERLACE_NONE)
+	{
+		cout << "ERROR: Interlaced PNGs cannot be streamed" << endl;
+		return false;
+	}
+
+	// normalise every colour type and depth to 8-bit RGBA
+	png_byte colour = png_get_color_type(reader->png, reader->pngInfo);
+	if (colour == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(reader->png);
+	if (colour == PNG_COLOR_TYPE_GRAY || colour == PNG_COLOR_TYPE_GRAY_ALPHA)
+		png_set_gray_to_rgb(reader->png);
+	if (png_get_valid(reader->png, reader->pngInfo, PNG_INFO_tRNS))
+		png_set_tRNS_to_alpha(reader->png);
+	png_set_expand(reader->png);
+	png_set_strip_16(reader->png);
+	png_set_filler(reader->png, 0xff, PNG_FILLER_AFTER);
+	png_read_update_info(reader->png, reader->pngInfo);
+
+	reader->width = png_get_image_width(reader->png, reader->pngInfo);
+	reader->height = png_get_image_height(reader->png, reader->pngInfo);
+	return true;
+}
+
+static bool OpenJpegReader(BandReader *reader)
+{
+	reader->jpeg.err = jpeg_std_error(&reader->jpegError.manager);
+	reader->jpegError.manager.error_exit = JpegErrorExit;
+	if (setjmp(reader->jpegError.jump)) return false;
+
+	jpeg_create_decompress(&reader->jpeg);
+	jpeg_stdio_src(&reader->jpeg, reader->file);
+	jpeg_read_header(&reader->jpeg, TRUE);
+	reader->jpeg.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&reader->jpeg);
+
+	reader->width = reader->jpeg.output_width;
+	reader->height = reader->jpeg.output_height;
+	reader->scanline.resize(size_t(reader->width) * 3);
+	return true;
+}
+
+static bool OpenBandReader(BandReader *reader, const char *filename)
+{
+	reader->file = fopen(filename, "rb");
+	if (!reader->file)
+	{
+		cout << "ERROR: Could not open " << filename << endl;
+		return false;
+	}
+
+	// pick the decoder by signature rather than by extension
+	unsigned char magic[8] = { 0 };
+	size_t got = fread(magic, 1, sizeof(magic), reader->file);
+	rewind(reader->file);
+
+	if (got == sizeof(magic) && png_sig_cmp(magic, 0, sizeof(magic)) == 0)
+	{
+		reader->format = BandReader::PNG;
+		return OpenPngReader(reader);
+	}
+	if (got >= 2 && magic[0] == 0xff && magic[1] == 0xd8)
+	{
+		reader->format = BandReader::JPEG;
+		return OpenJpegReader(reader);
+	}
+
+	cout << "ERROR: " << filename << " is neither PNG nor JPEG" << endl;
+	return false;
+}
+
+// reads the next rows of the image into pixels as RGBA8
+static bool ReadBand(BandReader *reader, unsigned char *pixels, int rows)
+{
+	size_t stride = size_t(reader->width) * 4;
+
+	if (reader->format == BandReader::PNG)
+	{
+		if (setjmp(png_jmpbuf(reader->png))) return false;
+		for (int y = 0; y < rows; y++)
+			png_read_row(reader->png, pixels + y*stride, 0);
+		return true;
+	}
+
+	if (setjmp(reader->jpegError.jump)) return false;
+	for (int y = 0; y < rows; y++)
+	{
+		JSAMPROW row = &reader->scanline[0];
+		jpeg_read_scanlines(&reader->jpeg, &row, 1);
+
+		unsigned char *out = pixels + y*stride;
+		for (int x = 0; x < reader->width; x++)
+		{
+			out[4*x + 0] = row[3*x + 0];
+			out[4*x + 1] = row[3*x + 1];
+			out[4*x + 2] = row[3*x + 2];
+			out[4*x + 3] = 0xff;
+		}
+	}
+	return true;
+}
+
+static void CloseBandReader(BandReader *reader)
+{
+	if (reader->format == BandReader::PNG)
+		png_destroy_read_struct(&reader->png, &reader->pngInfo, 0);
+	else if (reader->jpeg.mem && !setjmp(reader->jpegError.jump))
+		jpeg_destroy_decompress(&reader->jpeg);
+
+	if (reader->file) fclose(reader->file);
+	reader->file = 0;
+	reader->format = BandReader::NONE;
+}
+
+// --------------------------------------------------------------------------
+// Band writer: encodes RGBA8 scanlines to PNG or JPEG
+
+struct BandWriter
+{
+	enum Format { PNG, JPEG };
+
+	Format format;
+	FILE *file;
+	int width;
+
+	png_structp png;
+	png_infop pngInfo;
+
+	jpeg_compress_struct jpeg;
+	JpegError jpegError;
+	vector<unsigned char> scanline;
+
+	BandWriter() : format(PNG), file(0), width(0), png(0), pngInfo(0), jpeg()
+	{}
+};
+
+static bool HasExtension(const string &filename, const char *extension)
+{
+	size_t length = strlen(extension);
+	if (filename.size() < length) return false;
+	for (size_t i = 0; i < length; i++)
+		if (tolower(filename[filename.size() - length + i]) != extension[i])
+			return false;
+	return true;
+}
+
+static bool OpenBandWriter(BandWriter *writer, const char *filename, int width, int height)
+{
+	writer->width = width;
+	writer->format = (HasExtension(filename, ".jpg") || HasExtension(filename, ".jpeg"))
+		? BandWriter::JPEG : BandWriter::PNG;
+
+	writer->file = fopen(filename, "wb");
+	if (!writer->file)
+	{
+		cout << "ERROR: Could not create " << filename << endl;
+		return false;
+	}
+
+	if (writer->format == BandWriter::PNG)
+	{
+		writer->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0);
+		writer->pngInfo = writer->png ? png_create_info_struct(writer->png) : 0;
+		if (!writer->pngInfo) return false;
+		if (setjmp(png_jmpbuf(writer->png))) return false;
+
+		png_init_io(writer->png, writer->file);
+		png_set_IHDR(writer->png, writer->pngInfo, width, height, 8, PNG_COLOR_TYPE_RGBA,
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+		png_write_info(writer->png, writer->pngInfo);
+		return true;
+	}
+
+	writer->jpeg.err = jpeg_std_error(&writer->jpegError.manager);
+	writer->jpegError.manager.error_exit = JpegErrorExit;
+	if (setjmp(writer->jpegError.jump)) return false;
+
+	jpeg_create_compress(&writer->jpeg);
+	jpeg_stdio_dest(&writer->jpeg, writer->file);
+	writer->jpeg.image_width = width;
+	writer->jpeg.image_height = height;
+	writer->jpeg.input_components = 3;
+	writer->jpeg.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&writer->jpeg);
+	jpeg_set_quality(&writer->jpeg, 92, TRUE);
+	jpeg_start_compress(&writer->jpeg, TRUE);
+	writer->scanline.resize(size_t(width) * 3);
+	return true;
+}
+
+static bool WriteBand(BandWriter *writer, const unsigned char *pixels, int rows)
+{
+	size_t stride = size_t(writer->width) * 4;
+
+	if (writer->format == BandWriter::PNG)
+	{
+		if (setjmp(png_jmpbuf(writer->png))) return false;
+		for (int y = 0; y < rows; y++)
+			png_write_row(writer->png, (png_bytep)(pixels + y*stride));
+		return true;
+	}
+
+	// JPEG has no alpha; drop it on the way out
+	if (setjmp(writer->jpegError.jump)) return false;
+	for (int y = 0; y < rows; y++)
+	{
+		const unsigned char *in = pixels + y*stride;
+		JSAMPROW row = &writer->scanline[0];
+		for (int x = 0; x < writer->width; x++)
+		{
+			row[3*x + 0] = in[4*x + 0];
+			row[3*x + 1] = in[4*x + 1];
+			row[3*x + 2] = in[4*x + 2];
+		}
+		jpeg_write_scanlines(&writer->jpeg, &row, 1);
+	}
+	return true;
+}
+
+// finishes the output file; only called once every row has been written
+static bool FinishBandWriter(BandWriter *writer)
+{
+	if (writer->format == BandWriter::PNG)
+	{
+		if (setjmp(png_jmpbuf(writer->png))) return false;
+		png_write_end(writer->png, 0);
+		return true;
+	}
+
+	if (setjmp(writer->jpegError.jump)) return false;
+	jpeg_finish_compress(&writer->jpeg);
+	return true;
+}
+
+static void CloseBandWriter(BandWriter *writer)
+{
+	if (writer->format == BandWriter::PNG)
+	{
+		if (writer->png) png_destroy_write_struct(&writer->png, &writer->pngInfo);
+	}
+	else if (writer->jpeg.mem && !setjmp(writer->jpegError.jump))
+		jpeg_destroy_compress(&writer->jpeg);
+
+	if (writer->file) fclose(writer->file);
+	writer->file = 0;
+}
+
+// --------------------------------------------------------------------------
+// Streaming driver
+
+static long PeakMemoryKB()
+{
+#if defined(__APPLE__)
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return long(usage.ru_maxrss / 1024);		// bytes on macOS
+#elif defined(__unix__)
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return long(usage.ru_maxrss);				// kilobytes on Linux
+#else
+	return 0;
+#endif
+}
+
+bool StreamFilterImage(const char *input, const char *output, int mode,
+	int bandHeight, StreamStats *stats)
+{
+	// the neighbourhood modes (4-6) need rows outside the band
+	if (mode < 0 || mode > 3)
+	{
+		cout << "ERROR: Filter mode " << mode << " cannot be streamed, use 0-3" << endl;
+		return false;
+	}
+
+	auto start = chrono::steady_clock::now();
+	if (bandHeight < 1) bandHeight = 1;
+
+	BandReader reader;
+	BandWriter writer;
+	bool success = OpenBandReader(&reader, input)
+		&& OpenBandWriter(&writer, output, reader.width, reader.height);
+
+	// the only image-sized allocation: one band of RGBA rows
+	vector<unsigned char> band;
+	int bands = 0;
+	if (success)
+		band.resize(size_t(reader.width) * 4 * min(bandHeight, reader.height));
+
+	for (int y = 0; success && y < reader.height; y += bandHeight, bands++)
+	{
+		int rows = min(bandHeight, reader.height - y);
+		success = ReadBand(&reader, &band[0], rows);
+		if (!success) break;
+
+		FilterBand(&band[0], reader.width, rows, mode);
+		success = WriteBand(&writer, &band[0], rows);
+	}
+	if (success)
+		success = FinishBandWriter(&writer);
+
+	// jpeg_finish_decompress would only validate trailing markers; skipping
+	// it lets CloseBandReader tear down a partially read stream too
+	bool created = writer.file != 0;
+	CloseBandReader(&reader);
+	CloseBandWriter(&writer);
+
+	if (stats)
+	{
+		stats->width = reader.width;
+		stats->height = reader.height;
+		stats->bands = bands;
+		stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		stats->peakMemoryKB = PeakMemoryKB();
+	}
+
+	if (!success)
+	{
+		cout << "ERROR: Streaming " << input << " to " << output << " failed" << endl;
+		if (created) remove(output);
+	}
+	return success;
+}
+
+bool WriteImage(const char *filename, const unsigned char *pixels, int width, int height,
+	bool bottomUp)
+{
+	BandWriter writer;
+	bool success = OpenBandWriter(&writer, filename, width, height);
+
+	size_t stride = size_t(width) * 4;
+	for (int y = 0; success && y < height; y++)
+		success = WriteBand(&writer, pixels + (bottomUp ? height - 1 - y : y)*stride, 1);
+	if (success)
+		success = FinishBandWriter(&writer);
+
+	bool created = writer.file != 0;
+	CloseBandWriter(&writer);
+
+	if (!success)
+	{
+		cout << "ERROR: Could not write image " << filename << endl;
+		if (created) remove(filename);
+	}
+	return success;
+}
@@ -0,0 +1,39 @@
+// ==========================================================================
+// Bounded-memory streaming filter
+//
+// Applies the fragment.glsl filter modes to images too large to decode into
+// a single buffer. The source is read in horizontal bands of scanlines
+// (libpng / libjpeg), each band is filtered on the CPU and written straight
+// to the output encoder, so peak memory is O(width x band height) whatever
+// the image height.
+// ==========================================================================
+#ifndef STREAM_H
+#define STREAM_H
+
+struct StreamStats
+{
+	int width, height;
+	int bands;
+	double seconds;			// wall time for decode + filter + encode
+	long peakMemoryKB;		// process peak resident set size, 0 if unknown
+
+	StreamStats() : width(0), height(0), bands(0), seconds(0.0), peakMemoryKB(0)
+	{}
+};
+
+// applies filter mode (0 - passthrough, 1..3 - luminance, as in
+// fragment.glsl) to an RGBA8 band of rows in place
+void FilterBand(unsigned char *pixels, int width, int rows, int mode);
+
+// streams a PNG or JPEG input through the filter into a PNG or JPEG output
+// (chosen by extension), bandHeight rows at a time; returns true on success
+// and false for I/O errors or a mode other than 0-3
+bool StreamFilterImage(const char *input, const char *output, int mode,
+	int bandHeight = 256, StreamStats *stats = 0);
+
+// writes a whole RGBA8 image as PNG or JPEG (chosen by extension); bottomUp
+// images (texture / framebuffer row order) are flipped to read top-down
+bool WriteImage(const char *filename, const unsigned char *pixels, int width, int height,
+	bool bottomUp = false);
+
+#endif
@@ -0,0 +1,386 @@
+// ==========================================================================
+// CPU affine warp renderer
+//
+// For each output row the inverse transform gives the source coordinate of
+// the first pixel and a constant per-pixel step, and the span of pixels that
+// lands inside the image is clipped analytically. Inside the span, pixels are
+// sampled 8 (AVX2) or 4 (SSE2) at a time with a scalar loop for the tail;
+// rows are split into bands across threads.
+// ==========================================================================
+
+#include "warp.h"
+#include "stream.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define WARP_SSE2
+#endif
+
+#include "stb_image.h"
+
+#define PI 3.14159265359
+
+using namespace std;
+
+// --------------------------------------------------------------------------
+// View transform shared with drawFullPic
+
+ViewTransform ComputeViewTransform(float width, float height, float factor,
+	float theta, float offsetX, float offsetY, int windowWidth, int windowHeight)
+{
+	// half extents of the quad: the longer side of the image spans the view
+	float x = 1.0f, y = 1.0f;
+	if (height > width)
+		x = (width/2) * (1/(height/2));
+	else if (height < width)
+		y = (height/2) * (1/(width/2));
+
+	// window aspect correction; the ratio is an integer quotient, exactly as
+	// drawFullPic has always computed it
+	float windowRatio = 0.0f;
+	if (windowWidth > windowHeight)
+		windowRatio = windowWidth/windowHeight;
+	else if (windowHeight > windowWidth)
+		windowRatio = windowHeight/windowWidth;
+	float ax = windowHeight < windowWidth ? 1/windowRatio : 1.0f;
+	float ay = windowHeight > windowWidth ? 1/windowRatio : 1.0f;
+
+	float c = float(cos(theta*PI/180));
+	float s = float(sin(theta*PI/180));
+
+	// texel (s, t) sits at (kx*s - x/factor, ky*t - y/factor) on the quad
+	// before rotation, aspect correction and translation
+	float kx = width > 0 ? 2*x/(width*factor) : 0.0f;
+	float ky = height > 0 ? 2*y/(height*factor) : 0.0f;
+	float bx = -x/factor, by = -y/factor;
+
+	ViewTransform view;
+	view.m[0] = ax*c*kx;	view.m[1] = -ax*s*ky;	view.m[2] = ax*(c*bx - s*by) + offsetX;
+	view.m[3] = ay*s*kx;	view.m[4] = ay*c*ky;	view.m[5] = ay*(s*bx + c*by) + offsetY;
+	return view;
+}
+
+// --------------------------------------------------------------------------
+// Bilinear sampling, matching GL_LINEAR with GL_CLAMP_TO_EDGE on a
+// rectangle texture: texel centres sit at integer + 0.5
+
+struct WarpSource
+{
+	const unsigned int *texels;
+	int width, height;
+	float maxS, maxT;
+};
+
+static inline unsigned int SampleBilinear(const WarpSource &src, float s, float t)
+{
+	float fs = min(max(s - 0.5f, 0.0f), src.maxS);
+	float ft = min(max(t - 0.5f, 0.0f), src.maxT);
+	int x0 = int(fs), y0 = int(ft);
+	int x1 = min(x0 + 1, src.width - 1), y1 = min(y0 + 1, src.height - 1);
+	float fx = fs - x0, fy = ft - y0;
+
+	const unsigned int *row0 = src.texels + size_t(y0)*src.width;
+	const unsigned int *row1 = src.texels + size_t(y1)*src.width;
+	unsigned int a = row0[x0], b = row0[x1], c = row1[x0], d = row1[x1];
+
+	unsigned int result = 0;
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		float ca = float((a >> shift) & 0xff), cb = float((b >> shift) & 0xff);
+		float cc = float((c >> shift) & 0xff), cd = float((d >> shift) & 0xff);
+		float top = ca + (cb - ca)*fx;
+		float bottom = cc + (cd - cc)*fx;
+		result |= (unsigned int)lrintf(top + (bottom - top)*fy) << shift;
+	}
+	return result;
+}
+
+#if defined(__AVX2__)
+
+static inline __m256 Channel(__m256i texels, int shift)
+{
+	return _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(texels, shift),
+		_mm256_set1_epi32(0xff)));
+}
+
+// samples 8 pixels whose source coordinates are in s and t
+static inline __m256i SampleBilinear8(const WarpSource &src, __m256 s, __m256 t)
+{
+	const __m256 half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+	__m256 fs = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(s, half), zero), _mm256_set1_ps(src.maxS));
+	__m256 ft = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(t, half), zero), _mm256_set1_ps(src.maxT));
+	__m256 x0f = _mm256_floor_ps(fs), y0f = _mm256_floor_ps(ft);
+	__m256 fx = _mm256_sub_ps(fs, x0f), fy = _mm256_sub_ps(ft, y0f);
+
+	__m256i x0 = _mm256_cvttps_epi32(x0f);
+	__m256i x1 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_add_ps(x0f, one), _mm256_set1_ps(src.maxS)));
+	__m256i stride = _mm256_set1_epi32(src.width);
+	__m256i row0 = _mm256_mullo_epi32(_mm256_cvttps_epi32(y0f), stride);
+	__m256i row1 = _mm256_mullo_epi32(_mm256_cvttps_epi32(
+		_mm256_min_ps(_mm256_add_ps(y0f, one), _mm256_set1_ps(src.maxT))), stride);
+
+	const int *base = (const int *)src.texels;
+	__m256i a = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, x0), 4);
+	__m256i b = _mm256_i32gather_epi32(base, _mm256_add_epi32(row0, x1), 4);
+	__m256i c = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, x0), 4);
+	__m256i d = _mm256_i32gather_epi32(base, _mm256_add_epi32(row1, x1), 4);
+
+	__m256i result = _mm256_setzero_si256();
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		__m256 ca = Channel(a, shift), cb = Channel(b, shift);
+		__m256 cc = Channel(c, shift), cd = Channel(d, shift);
+		__m256 top = _mm256_add_ps(ca, _mm256_mul_ps(_mm256_sub_ps(cb, ca), fx));
+		__m256 bottom = _mm256_add_ps(cc, _mm256_mul_ps(_mm256_sub_ps(cd, cc), fx));
+		__m256 value = _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), fy));
+		result = _mm256_or_si256(result, _mm256_slli_epi32(_mm256_cvtps_epi32(value), shift));
+	}
+	return result;
+}
+
+#elif defined(WARP_SSE2)
+
+static inline __m128 Channel(__m128i texels, int shift)
+{
+	return _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(texels, shift), _mm_set1_epi32(0xff)));
+}
+
+// samples 4 pixels whose source coordinates are in s and t; SSE2 has no
+// gather or 32-bit multiply, so the texel fetches are done in scalar code
+static inline __m128i SampleBilinear4(const WarpSource &src, __m128 s, __m128 t)
+{
+	const __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	__m128 fs = _mm_min_ps(_mm_max_ps(_mm_sub_ps(s, half), zero), _mm_set1_ps(src.maxS));
+	__m128 ft = _mm_min_ps(_mm_max_ps(_mm_sub_ps(t, half), zero), _mm_set1_ps(src.maxT));
+
+	// coordinates are non-negative here, so truncation is floor
+	__m128i x0 = _mm_cvttps_epi32(fs), y0 = _mm_cvttps_epi32(ft);
+	__m128 x0f = _mm_cvtepi32_ps(x0), y0f = _mm_cvtepi32_ps(y0);
+	__m128 fx = _mm_sub_ps(fs, x0f), fy = _mm_sub_ps(ft, y0f);
+	__m128i x1 = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(x0f, one), _mm_set1_ps(src.maxS)));
+	__m128i y1 = _mm_cvttps_epi32(_mm_min_ps(_mm_add_ps(y0f, one), _mm_set1_ps(src.maxT)));
+
+	alignas(16) int ix0[4], ix1[4], iy0[4], iy1[4];
+	_mm_store_si128((__m128i *)ix0, x0);
+	_mm_store_si128((__m128i *)ix1, x1);
+	_mm_store_si128((__m128i *)iy0, y0);
+	_mm_store_si128((__m128i *)iy1, y1);
+
+	alignas(16) unsigned int ta[4], tb[4], tc[4], td[4];
+	for (int k = 0; k < 4; k++)
+	{
+		const unsigned int *row0 = src.texels + size_t(iy0[k])*src.width;
+		const unsigned int *row1 = src.texels + size_t(iy1[k])*src.width;
+		ta[k] = row0[ix0[k]]; tb[k] = row0[ix1[k]];
+		tc[k] = row1[ix0[k]]; td[k] = row1[ix1[k]];
+	}
+	__m128i a = _mm_load_si128((const __m128i *)ta), b = _mm_load_si128((const __m128i *)tb);
+	__m128i c = _mm_load_si128((const __m128i *)tc), d = _mm_load_si128((const __m128i *)td);
+
+	__m128i result = _mm_setzero_si128();
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		__m128 ca = Channel(a, shift), cb = Channel(b, shift);
+		__m128 cc = Channel(c, shift), cd = Channel(d, shift);
+		__m128 top = _mm_add_ps(ca, _mm_mul_ps(_mm_sub_ps(cb, ca), fx));
+		__m128 bottom = _mm_add_ps(cc, _mm_mul_ps(_mm_sub_ps(cd, cc), fx));
+		__m128 value = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fy));
+		result = _mm_or_si128(result, _mm_slli_epi32(_mm_cvtps_epi32(value), shift));
+	}
+	return result;
+}
+
+#endif
+
+// --------------------------------------------------------------------------
+// Scanline renderer
+
+struct WarpInverse
+{
+	// source coordinate of output pixel (0, row) and per-pixel / per-row steps
+	double s0, t0, dsdx, dtdx, dsdy, dtdy;
+};
+
+// clips the pixels [*lo, *hi) for which 0 <= start + px*step < limit
+static void ClipSpan(double start, double step, double limit, int *lo, int *hi)
+{
+	if (step == 0.0)
+	{
+		if (start < 0.0 || start >= limit) *hi = *lo;
+		return;
+	}
+
+	// clamped so far-off spans cannot overflow the int conversion
+	double enter = (step > 0.0 ? 0.0 - start : limit - start) / step;
+	double leave = (step > 0.0 ? limit - start : 0.0 - start) / step;
+	enter = min(max(enter, -2.0), double(*hi) + 2.0);
+	leave = min(max(leave, -2.0), double(*hi) + 2.0);
+	int first = step > 0.0 ? int(ceil(enter)) : int(floor(enter)) + 1;
+	int last = step > 0.0 ? int(ceil(leave)) : int(floor(leave)) + 1;
+	*lo = max(*lo, first);
+	*hi = min(*hi, last);
+}
+
+static void RenderRows(const WarpSource &src, const WarpInverse &inv, int filterMode,
+	CpuImage *target, int firstRow, int lastRow)
+{
+	const unsigned int black = 0xff000000u;		// opaque, as glClearColor sets it
+
+	for (int row = firstRow; row < lastRow; row++)
+	{
+		unsigned int *out = (unsigned int *)&target->pixels[0] + size_t(row)*target->width;
+
+		double rowS = inv.s0 + row*inv.dsdy;
+		double rowT = inv.t0 + row*inv.dtdy;
+
+		int lo = 0, hi = target->width;
+		ClipSpan(rowS, inv.dsdx, src.width, &lo, &hi);
+		ClipSpan(rowT, inv.dtdx, src.height, &lo, &hi);
+		if (hi <= lo) lo = hi = 0;
+
+		fill(out, out + lo, black);
+		fill(out + hi, out + target->width, black);
+
+		// step along the scanline by pixel index from the span start; the
+		// index is exact in float, so coordinates do not drift across the row
+		float s = float(rowS + lo*inv.dsdx), t = float(rowT + lo*inv.dtdx);
+		float ds = float(inv.dsdx), dt = float(inv.dtdx);
+		int px = lo;
+
+#if defined(__AVX2__)
+		const __m256 sv = _mm256_set1_ps(s), tv = _mm256_set1_ps(t);
+		const __m256 dsv = _mm256_set1_ps(ds), dtv = _mm256_set1_ps(dt), step = _mm256_set1_ps(8.0f);
+		__m256 index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+		for (; px + 8 <= hi; px += 8, index = _mm256_add_ps(index, step))
+			_mm256_storeu_si256((__m256i *)(out + px), SampleBilinear8(src,
+				_mm256_add_ps(sv, _mm256_mul_ps(index, dsv)),
+				_mm256_add_ps(tv, _mm256_mul_ps(index, dtv))));
+#elif defined(WARP_SSE2)
+		const __m128 sv = _mm_set1_ps(s), tv = _mm_set1_ps(t);
+		const __m128 dsv = _mm_set1_ps(ds), dtv = _mm_set1_ps(dt), step = _mm_set1_ps(4.0f);
+		__m128 index = _mm_setr_ps(0, 1, 2, 3);
+		for (; px + 4 <= hi; px += 4, index = _mm_add_ps(index, step))
+			_mm_storeu_si128((__m128i *)(out + px), SampleBilinear4(src,
+				_mm_add_ps(sv, _mm_mul_ps(index, dsv)),
+				_mm_add_ps(tv, _mm_mul_ps(index, dtv))));
+#endif
+
+		for (; px < hi; px++)
+			out[px] = SampleBilinear(src, s + (px - lo)*ds, t + (px - lo)*dt);
+	}
+
+	// the fragment filter runs on the sampled colour, as in fragment.glsl
+	if (filterMode != 0 && lastRow > firstRow)
+		FilterBand(&target->pixels[0] + size_t(firstRow)*target->width*4,
+			target->width, lastRow - firstRow, filterMode);
+}
+
+// --------------------------------------------------------------------------
+// Public interface
+
+bool LoadCpuImage(CpuImage *image, const char *filename)
+{
+	// InitializeTexture flips on load so row 0 is the bottom of the picture
+	stbi_set_flip_vertically_on_load(true);
+
+	int channels = 0;
+	unsigned char *data = stbi_load(filename, &image->width, &image->height, &channels, 4);
+	if (!data)
+	{
+		cout << "ERROR: Could not load image " << filename << endl;
+		image->width = image->height = 0;
+		image->pixels.clear();
+		return false;
+	}
+
+	image->pixels.assign(data, data + size_t(image->width) * image->height * 4);
+	stbi_image_free(data);
+	return true;
+}
+
+void RenderViewCpu(const CpuImage &source, const ViewTransform &view, int filterMode,
+	CpuImage *target, int threads)
+{
+	target->pixels.resize(size_t(target->width) * target->height * 4);
+	if (target->width <= 0 || target->height <= 0) return;
+
+	WarpSource src;
+	src.texels = source.pixels.empty() ? 0 : (const unsigned int *)&source.pixels[0];
+	src.width = source.width;
+	src.height = source.height;
+	src.maxS = float(source.width - 1);
+	src.maxT = float(source.height - 1);
+
+	// invert the texel -> NDC map; a degenerate view covers nothing
+	const float *m = view.m;
+	double det = double(m[0])*m[4] - double(m[1])*m[3];
+	WarpInverse inv;
+	if (!src.texels || det == 0.0)
+	{
+		src.width = src.height = 0;
+		inv.s0 = inv.t0 = -1.0;
+		inv.dsdx = inv.dtdx = inv.dsdy = inv.dtdy = 0.0;
+	}
+	else
+	{
+		// NDC of pixel centres: x = (px + 0.5)*2/W - 1, y = (py + 0.5)*2/H - 1
+		double ndcStepX = 2.0/target->width, ndcStepY = 2.0/target->height;
+		double x0 = 0.5*ndcStepX - 1.0 - m[2], y0 = 0.5*ndcStepY - 1.0 - m[5];
+
+		inv.s0 = ( m[4]*x0 - m[1]*y0) / det;
+		inv.t0 = (-m[3]*x0 + m[0]*y0) / det;
+		inv.dsdx =  m[4]*ndcStepX / det;
+		inv.dtdx = -m[3]*ndcStepX / det;
+		inv.dsdy = -m[1]*ndcStepY / det;
+		inv.dtdy =  m[0]*ndcStepY / det;
+	}
+
+	if (threads <= 0)
+		threads = max(1, int(std::thread::hardware_concurrency()));
+	threads = min(threads, target->height);
+
+	// row bands; the calling thread renders the last one itself
+	vector<std::thread> workers;
+	int rowsPerBand = (target->height + threads - 1) / threads;
+	for (int first = 0; first < target->height; first += rowsPerBand)
+	{
+		int last = min(first + rowsPerBand, target->height);
+		if (last == target->height)
+			RenderRows(src, inv, filterMode, target, first, last);
+		else
+			workers.push_back(std::thread(RenderRows, std::cref(src), std::cref(inv),
+				filterMode, target, first, last));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+bool RenderThumbnail(const char *input, const char *output, int size, int filterMode)
+{
+	// RenderViewCpu only implements fragment.glsl's modes
+	if (filterMode < 0 || filterMode > 3)
+	{
+		cout << "ERROR: Filter mode " << filterMode << " has no CPU renderer, use 0-3" << endl;
+		return false;
+	}
+
+	CpuImage source;
+	if (!LoadCpuImage(&source, input))
+		return false;
+
+	// a square window keeps the view's aspect handling exact
+	CpuImage thumbnail;
+	thumbnail.width = thumbnail.height = max(1, size);
+	ViewTransform view = ComputeViewTransform(float(source.width), float(source.height),
+		1.0f, 0.0f, 0.0f, 0.0f, thumbnail.width, thumbnail.height);
+	RenderViewCpu(source, view, filterMode, &thumbnail);
+
+	return WriteImage(output, &thumbnail.pixels[0], thumbnail.width, thumbnail.height, true);
+}
@@ -0,0 +1,64 @@
+// ==========================================================================
+// CPU affine warp renderer
+//
+// Reproduces drawFullPic's view (rotation by theta, uniform scale, window
+// aspect correction and translation) without a GL context. Every output
+// pixel is inverse-mapped into the source image and bilinearly sampled the
+// way a GL_LINEAR rectangle texture would be, so the result can be used for
+// headless thumbnails or compared pixel-for-pixel against the GL output.
+// ==========================================================================
+#ifndef WARP_H
+#define WARP_H
+
+#include <vector>
+
+// affine map from texel coordinates (s, t) to normalized device coordinates:
+//   x = m[0]*s + m[1]*t + m[2]
+//   y = m[3]*s + m[4]*t + m[5]
+struct ViewTransform
+{
+	float m[6];
+
+	ViewTransform()
+	{
+		m[0] = 1.f; m[1] = 0.f; m[2] = 0.f;
+		m[3] = 0.f; m[4] = 1.f; m[5] = 0.f;
+	}
+
+	void Apply(float s, float t, float *x, float *y) const
+	{
+		*x = m[0]*s + m[1]*t + m[2];
+		*y = m[3]*s + m[4]*t + m[5];
+	}
+};
+
+// RGBA8 image stored bottom row first, the order of both texture uploads
+// (row 0 is t = 0) and glReadPixels
+struct CpuImage
+{
+	int width, height;
+	std::vector<unsigned char> pixels;
+
+	CpuImage() : width(0), height(0)
+	{}
+};
+
+// the transform drawFullPic applies to an image of the given size
+ViewTransform ComputeViewTransform(float texWidth, float texHeight, float factor,
+	float theta, float offsetX, float offsetY, int windowWidth, int windowHeight);
+
+// decodes an image file the same way InitializeTexture does
+bool LoadCpuImage(CpuImage *image, const char *filename);
+
+// renders source through view into target (already sized to the window),
+// clearing uncovered pixels to opaque black and applying filter mode as in
+// fragment.glsl; rows are split over threads (0 picks one per core)
+void RenderViewCpu(const CpuImage &source, const ViewTransform &view, int filterMode,
+	CpuImage *target, int threads = 0);
+
+// renders an image file as drawFullPic would show it in a square window of
+// size x size pixels and writes the result to a PNG or JPEG file; filterMode
+// must be 0-3
+bool RenderThumbnail(const char *input, const char *output, int size, int filterMode = 0);
+
+#endif